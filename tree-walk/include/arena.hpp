@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator owning all the nodes of a parsed program, which reference each other through
+// raw pointers. Nodes are never freed one by one: they all go away with the arena.
+// In the REPL every line gets its own arena, kept alive by the functions declared in it.
+class Arena : public std::enable_shared_from_this<Arena>
+{
+public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena();
+
+  template <typename T, typename... Args> T *make(Args &&...args)
+  {
+    auto node = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr(!std::is_trivially_destructible_v<T>) {
+      destructors.emplace_back(node, [](void *p) { static_cast<T *>(p)->~T(); });
+    }
+    return node;
+  }
+
+private:
+  void *allocate(std::size_t size, std::size_t align);
+
+  static constexpr std::size_t block_size = 32 * 1024;
+  std::vector<std::unique_ptr<std::byte[]>> blocks;
+  std::byte *next{nullptr};
+  std::byte *end{nullptr};
+  // nodes hold tokens and vectors, so their destructors still have to run
+  std::vector<std::pair<void *, void (*)(void *)>> destructors;
+};
@@ -5,16 +5,16 @@ class ASTVisitor : public expr::Visitor<std::string>
 public:
   std::string visit_binary_expr(const expr::Binary &expr) override
   {
-    return parenthesize(expr.op.get_lexeme(), *expr.left.get(), *expr.right.get());
+    return parenthesize(expr.op.get_lexeme(), *expr.left, *expr.right);
   }
   std::string visit_grouping_expr(const expr::Grouping &expr) override
   {
-    return parenthesize("group", *expr.expr.get());
+    return parenthesize("group", *expr.expr);
   }
   std::string visit_literal_expr(const expr::Literal &expr) override
   {
     if(expr.value.is_string()) {
-      return std::get<std::string>(expr.value.v);
+      return expr.value.as<LoxString>().str();
     }
     else if(expr.value.is_double()) {
       return std::to_string(std::get<double>(expr.value.v));
@@ -25,15 +25,15 @@ public:
   }
   std::string visit_unary_expr(const expr::Unary &expr) override
   {
-    return parenthesize(expr.op.get_lexeme(), *expr.right.get());
+    return parenthesize(expr.op.get_lexeme(), *expr.right);
   }
 
   std::string print(expr::ExprBase &expr) { return expr.accept(*this); }
 
 private:
-  template <typename... Args> std::string parenthesize(const std::string &name, Args &&...expr)
+  template <typename... Args> std::string parenthesize(std::string_view name, Args &&...expr)
   {
-    std::string result = "(" + name;
+    std::string result = "(" + std::string(name);
 
     ([&] { result += " " + expr.accept(*this); }(), ...);
 
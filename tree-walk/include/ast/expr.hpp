@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string.hpp>
 #include <visitor.hpp>
 #include <variant>
 #include <token.hpp>
@@ -13,7 +14,7 @@ namespace expr
   public:
     virtual ~Value() = default;
 
-    Value(const std::string &s) : v(s) {}
+    Value(LoxString s) : v(std::move(s)) {}
     Value(double d) : v(d) {}
     Value(bool b) : v(b) {}
     Value(std::shared_ptr<LoxCallable> f) : v(std::move(f)) {}
@@ -22,13 +23,13 @@ namespace expr
 
     template <typename T> const T &as() const { return std::get<T>(v); }
     template <typename T> T &as() { return std::get<T>(v); }
-    bool is_string() const { return std::holds_alternative<std::string>(v); }
+    bool is_string() const { return std::holds_alternative<LoxString>(v); }
     bool is_double() const { return std::holds_alternative<double>(v); }
     bool is_bool() const { return std::holds_alternative<bool>(v); }
     bool is_nil() const { return std::holds_alternative<std::monostate>(v); }
     bool is_callable() const { return std::holds_alternative<std::shared_ptr<LoxCallable>>(v); };
     bool is_instance() const { return std::holds_alternative<std::shared_ptr<LoxInstance>>(v); };
-    std::variant<std::monostate, std::string, double, bool, std::shared_ptr<LoxCallable>,
+    std::variant<std::monostate, LoxString, double, bool, std::shared_ptr<LoxCallable>,
                  std::shared_ptr<LoxInstance>>
       v{};
   };
@@ -43,9 +44,7 @@ namespace expr
   };
 
   struct Binary : public ExprBase {
-    Binary(std::shared_ptr<ExprBase> &&left, const Token &op, std::shared_ptr<ExprBase> &&right)
-        : left(std::move(left)), op(op), right(std::move(right))
-    {}
+    Binary(ExprBase *left, const Token &op, ExprBase *right) : left(left), op(op), right(right) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
       return visitor.visit_binary_expr(*this);
@@ -55,15 +54,14 @@ namespace expr
       return visitor.visit_binary_expr(*this);
     }
     void accept(Visitor<void> &visitor) const override { visitor.visit_binary_expr(*this); }
-    std::shared_ptr<ExprBase> left;
+    ExprBase *left;
     Token op;
-    std::shared_ptr<ExprBase> right;
+    ExprBase *right;
   };
 
   struct Call : public ExprBase {
-    Call(std::shared_ptr<ExprBase> &&callee, const Token &paren,
-         std::vector<std::shared_ptr<ExprBase>> &&arguments)
-        : callee(std::move(callee)), paren(paren), arguments(std::move(arguments))
+    Call(ExprBase *callee, const Token &paren, std::vector<ExprBase *> &&arguments)
+        : callee(callee), paren(paren), arguments(std::move(arguments))
     {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
@@ -71,13 +69,13 @@ namespace expr
     }
     Value accept(Visitor<Value> &visitor) const override { return visitor.visit_call_expr(*this); }
     void accept(Visitor<void> &visitor) const override { visitor.visit_call_expr(*this); }
-    std::shared_ptr<ExprBase> callee;
+    ExprBase *callee;
     Token paren;
-    std::vector<std::shared_ptr<ExprBase>> arguments;
+    std::vector<ExprBase *> arguments;
   };
 
   struct Grouping : public ExprBase {
-    Grouping(std::shared_ptr<ExprBase> &&expr) : expr(std::move(expr)) {}
+    Grouping(ExprBase *expr) : expr(expr) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
       return visitor.visit_grouping_expr(*this);
@@ -87,22 +85,11 @@ namespace expr
       return visitor.visit_grouping_expr(*this);
     }
     void accept(Visitor<void> &visitor) const override { visitor.visit_grouping_expr(*this); }
-    std::shared_ptr<ExprBase> expr;
+    ExprBase *expr;
   };
 
   struct Literal : public ExprBase {
-    Literal(const Token::Literal &l)
-    {
-      if(std::holds_alternative<std::string>(l)) {
-        value = std::get<std::string>(l);
-      }
-      else if(std::holds_alternative<double>(l)) {
-        value = std::get<double>(l);
-      }
-      else if(std::holds_alternative<bool>(l)) {
-        value = std::get<bool>(l);
-      }
-    }
+    Literal(Value value) : value(std::move(value)) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
       return visitor.visit_literal_expr(*this);
@@ -116,9 +103,7 @@ namespace expr
   };
 
   struct Logical : public ExprBase {
-    Logical(std::shared_ptr<ExprBase> &&left, const Token &op, std::shared_ptr<ExprBase> &&right)
-        : left(std::move(left)), op(op), right(std::move(right))
-    {}
+    Logical(ExprBase *left, const Token &op, ExprBase *right) : left(left), op(op), right(right) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
       return visitor.visit_logical_expr(*this);
@@ -128,13 +113,20 @@ namespace expr
       return visitor.visit_logical_expr(*this);
     }
     void accept(Visitor<void> &visitor) const override { visitor.visit_logical_expr(*this); }
-    std::shared_ptr<ExprBase> left;
+    ExprBase *left;
     Token op;
-    std::shared_ptr<ExprBase> right;
+    ExprBase *right;
+  };
+
+  // Written by the Resolver on the expressions that refer to a variable: how many environments up
+  // the chain the variable lives, and its slot there. Globals keep a depth of -1.
+  struct Resolved {
+    mutable int depth{-1};
+    mutable int slot{0};
   };
 
   struct Unary : public ExprBase {
-    Unary(const Token &op, std::shared_ptr<ExprBase> &&right) : op(op), right(std::move(right)) {}
+    Unary(const Token &op, ExprBase *right) : op(op), right(right) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
       return visitor.visit_unary_expr(*this);
@@ -142,63 +134,59 @@ namespace expr
     Value accept(Visitor<Value> &visitor) const override { return visitor.visit_unary_expr(*this); }
     void accept(Visitor<void> &visitor) const override { visitor.visit_unary_expr(*this); }
     Token op;
-    std::shared_ptr<ExprBase> right;
+    ExprBase *right;
   };
 
-  struct Variable : public ExprBase, public std::enable_shared_from_this<const Variable> {
+  struct Variable : public ExprBase, public Resolved {
     Variable(const Token &token) : token(token) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
-      return visitor.visit_variable_expr(shared_from_this());
+      return visitor.visit_variable_expr(*this);
     }
     Value accept(Visitor<Value> &visitor) const override
     {
-      return visitor.visit_variable_expr(shared_from_this());
+      return visitor.visit_variable_expr(*this);
     }
     void accept(Visitor<void> &visitor) const override
     {
-      visitor.visit_variable_expr(shared_from_this());
+      visitor.visit_variable_expr(*this);
     }
     Token token;
   };
 
-  struct Assignment : public ExprBase, public std::enable_shared_from_this<const Assignment> {
-    Assignment(const Token &token, std::shared_ptr<ExprBase> &&value)
-        : token(token), value(std::move(value))
-    {}
+  struct Assignment : public ExprBase, public Resolved {
+    Assignment(const Token &token, ExprBase *value) : token(token), value(value) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
-      return visitor.visit_assignment_expr(shared_from_this());
+      return visitor.visit_assignment_expr(*this);
     }
     Value accept(Visitor<Value> &visitor) const override
     {
-      return visitor.visit_assignment_expr(shared_from_this());
+      return visitor.visit_assignment_expr(*this);
     }
     void accept(Visitor<void> &visitor) const override
     {
-      visitor.visit_assignment_expr(shared_from_this());
+      visitor.visit_assignment_expr(*this);
     }
     Token token;
-    std::shared_ptr<ExprBase> value;
+    ExprBase *value;
   };
 
   struct Get : public ExprBase {
-    Get(std::shared_ptr<ExprBase> &&object, const Token &name)
-        : object(std::move(object)), name(name)
-    {}
+    Get(ExprBase *object, const Token &name) : object(object), name(name) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
       return visitor.visit_get_expr(*this);
     }
     Value accept(Visitor<Value> &visitor) const override { return visitor.visit_get_expr(*this); }
     void accept(Visitor<void> &visitor) const override { visitor.visit_get_expr(*this); }
-    std::shared_ptr<ExprBase> object;
+    ExprBase *object;
     Token name;
   };
 
   struct Set : public ExprBase {
-    Set(std::shared_ptr<ExprBase> &&object, const Token &name, std::shared_ptr<ExprBase> &&value)
-        : object(std::move(object)), name(name), value(std::move(value))
+    Set(ExprBase *object, const Token &name, ExprBase *value)
+        : object(object), name(name), value(value)
     {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
@@ -206,41 +194,41 @@ namespace expr
     }
     Value accept(Visitor<Value> &visitor) const override { return visitor.visit_set_expr(*this); }
     void accept(Visitor<void> &visitor) const override { visitor.visit_set_expr(*this); }
-    std::shared_ptr<ExprBase> object;
+    ExprBase *object;
     Token name;
-    std::shared_ptr<ExprBase> value;
+    ExprBase *value;
   };
 
-  struct This : public ExprBase, public std::enable_shared_from_this<const This> {
+  struct This : public ExprBase, public Resolved {
     This(const Token &token) : token(token) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
-      return visitor.visit_this_expr(shared_from_this());
+      return visitor.visit_this_expr(*this);
     }
     Value accept(Visitor<Value> &visitor) const override
     {
-      return visitor.visit_this_expr(shared_from_this());
+      return visitor.visit_this_expr(*this);
     }
     void accept(Visitor<void> &visitor) const override
     {
-      visitor.visit_this_expr(shared_from_this());
+      visitor.visit_this_expr(*this);
     }
     Token token;
   };
 
-  struct Super : public ExprBase, public std::enable_shared_from_this<const Super> {
+  struct Super : public ExprBase, public Resolved {
     Super(const Token &keyword, const Token &method) : keyword(keyword), method(method) {}
     std::string accept(Visitor<std::string> &visitor) const override
     {
-      return visitor.visit_super_expr(shared_from_this());
+      return visitor.visit_super_expr(*this);
     }
     Value accept(Visitor<Value> &visitor) const override
     {
-      return visitor.visit_super_expr(shared_from_this());
+      return visitor.visit_super_expr(*this);
     }
     void accept(Visitor<void> &visitor) const override
     {
-      visitor.visit_super_expr(shared_from_this());
+      visitor.visit_super_expr(*this);
     }
     Token keyword;
     Token method;
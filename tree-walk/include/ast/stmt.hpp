@@ -2,102 +2,144 @@
 
 #include <ast/expr.hpp>
 
+class Arena;
+
 namespace stmt
 {
 
+  // How the execution of a statement ended: normally, or with a `return` that has to unwind to
+  // the enclosing call, carrying the returned value.
+  struct Completion {
+    enum class Type { NORMAL, RETURN };
+    Type type{Type::NORMAL};
+    expr::Value value{};
+  };
+
   class StmtBase
   {
   public:
     virtual ~StmtBase() = default;
     virtual void accept(Visitor<void> &visitor) const = 0;
+    virtual Completion accept(Visitor<Completion> &visitor) const = 0;
   };
 
   // This is an expression statement,
   // i.e. an expression followed by a semicolon
   struct Expression : public StmtBase {
-    Expression(std::shared_ptr<expr::ExprBase> &&ex) : ex(std::move(ex)) {}
+    Expression(expr::ExprBase *ex) : ex(ex) {}
     void accept(Visitor<void> &visitor) const override { visitor.visit_expr_stmt(*this); }
-    std::shared_ptr<expr::ExprBase> ex;
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_expr_stmt(*this);
+    }
+    expr::ExprBase *ex;
   };
 
   struct VariableDecl : public StmtBase {
-    VariableDecl(const Token &token, std::shared_ptr<expr::ExprBase> &&initializer)
-        : token(token), initializer(std::move(initializer))
+    VariableDecl(const Token &token, expr::ExprBase *initializer)
+        : token(token), initializer(initializer)
     {}
     void accept(Visitor<void> &visitor) const override { visitor.visit_vardecl_stmt(*this); }
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_vardecl_stmt(*this);
+    }
     Token token;
-    std::shared_ptr<expr::ExprBase> initializer;
+    expr::ExprBase *initializer;
   };
 
   struct Print : public StmtBase {
-    Print(std::shared_ptr<expr::ExprBase> &&ex) : ex(std::move(ex)) {}
+    Print(expr::ExprBase *ex) : ex(ex) {}
     void accept(Visitor<void> &visitor) const override { visitor.visit_print_stmt(*this); }
-    std::shared_ptr<expr::ExprBase> ex;
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_print_stmt(*this);
+    }
+    expr::ExprBase *ex;
   };
 
   struct Block : public StmtBase {
-    Block(std::vector<std::shared_ptr<StmtBase>> &&statements) : statements(std::move(statements))
+    Block(std::vector<StmtBase *> &&statements) : statements(std::move(statements))
     {}
     void accept(Visitor<void> &visitor) const override { visitor.visit_block_stmt(*this); }
-    std::vector<std::shared_ptr<stmt::StmtBase>> statements;
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_block_stmt(*this);
+    }
+    std::vector<StmtBase *> statements;
   };
 
   struct If : public StmtBase {
-    If(std::shared_ptr<expr::ExprBase> &&condition, std::shared_ptr<stmt::StmtBase> &&then_stm,
-       std::shared_ptr<stmt::StmtBase> &&else_stm)
-        : condition(std::move(condition)), then_stm(std::move(then_stm)),
-          else_stm(std::move(else_stm))
+    If(expr::ExprBase *condition, StmtBase *then_stm, StmtBase *else_stm)
+        : condition(condition), then_stm(then_stm), else_stm(else_stm)
     {}
     void accept(Visitor<void> &visitor) const override { visitor.visit_if_stmt(*this); }
-    std::shared_ptr<expr::ExprBase> condition;
-    std::shared_ptr<stmt::StmtBase> then_stm;
-    std::shared_ptr<stmt::StmtBase> else_stm;
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_if_stmt(*this);
+    }
+    expr::ExprBase *condition;
+    StmtBase *then_stm;
+    StmtBase *else_stm;
   };
 
   struct While : public StmtBase {
-    While(std::shared_ptr<expr::ExprBase> &&condition, std::shared_ptr<stmt::StmtBase> &&body)
-        : condition(std::move(condition)), body(std::move(body))
-    {}
+    While(expr::ExprBase *condition, StmtBase *body) : condition(condition), body(body) {}
     void accept(Visitor<void> &visitor) const override { visitor.visit_while_stmt(*this); }
-    std::shared_ptr<expr::ExprBase> condition;
-    std::shared_ptr<stmt::StmtBase> body;
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_while_stmt(*this);
+    }
+    expr::ExprBase *condition;
+    StmtBase *body;
   };
 
-  struct Function : public StmtBase, public std::enable_shared_from_this<const Function> {
-    Function(const Token &name, const std::vector<Token> &params,
-             std::vector<std::shared_ptr<stmt::StmtBase>> &&body)
-        : name(name), params(params), body(std::move(body))
+  struct Function : public StmtBase {
+    Function(const Token &name, const std::vector<Token> &params, std::vector<StmtBase *> &&body,
+             const Arena &arena)
+        : name(name), params(params), body(std::move(body)), arena(arena)
     {}
     void accept(Visitor<void> &visitor) const override
     {
-      visitor.visit_fun_stmt(shared_from_this());
+      visitor.visit_fun_stmt(*this);
+    }
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_fun_stmt(*this);
     }
     Token name;
     std::vector<Token> params;
-    std::vector<std::shared_ptr<stmt::StmtBase>> body;
+    std::vector<StmtBase *> body;
+    // the arena owning this declaration: functions created from it keep it alive
+    const Arena &arena;
   };
 
   struct Return : public StmtBase {
-    Return(const Token &keyword, std::shared_ptr<expr::ExprBase> &&value)
-        : keyword(keyword), value(std::move(value))
-    {}
+    Return(const Token &keyword, expr::ExprBase *value) : keyword(keyword), value(value) {}
     void accept(Visitor<void> &visitor) const override { visitor.visit_return_stmt(*this); }
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_return_stmt(*this);
+    }
     Token keyword;
-    std::shared_ptr<expr::ExprBase> value;
+    expr::ExprBase *value;
   };
 
-  struct Class : public StmtBase, public std::enable_shared_from_this<const Class> {
-    Class(const Token &name, std::shared_ptr<expr::Variable> &&superclass,
-          std::vector<std::shared_ptr<Function>> &&methods)
-        : name(name), superclass(std::move(superclass)), methods(std::move(methods))
+  struct Class : public StmtBase {
+    Class(const Token &name, expr::Variable *superclass, std::vector<Function *> &&methods)
+        : name(name), superclass(superclass), methods(std::move(methods))
     {}
     void accept(Visitor<void> &visitor) const override
     {
-      visitor.visit_class_stmt(shared_from_this());
+      visitor.visit_class_stmt(*this);
+    }
+    Completion accept(Visitor<Completion> &visitor) const override
+    {
+      return visitor.visit_class_stmt(*this);
     }
     Token name;
-    std::shared_ptr<expr::Variable> superclass;
-    std::vector<std::shared_ptr<Function>> methods;
+    expr::Variable *superclass;
+    std::vector<Function *> methods;
   };
 
 } // namespace stmt
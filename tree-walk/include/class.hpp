@@ -10,16 +10,16 @@ class LoxClass : public LoxCallable, public std::enable_shared_from_this<LoxClas
 {
 public:
   LoxClass(const std::string &name, std::shared_ptr<const LoxClass> &&superclass,
-           std::unordered_map<std::string, std::shared_ptr<LoxFunction>> &&methods)
+           LexemeMap<std::shared_ptr<LoxFunction>> &&methods)
       : name(name), superclass(std::move(superclass)), methods(std::move(methods))
   {}
   std::string to_string() const { return name; }
   int arity() const override;
   expr::Value call(Interpreter &interpreter, const std::vector<expr::Value> &args) override;
-  std::shared_ptr<LoxFunction> find_method(const std::string &name) const;
+  std::shared_ptr<LoxFunction> find_method(std::string_view name) const;
 
 private:
   std::string name;
   std::shared_ptr<const LoxClass> superclass;
-  std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods;
+  LexemeMap<std::shared_ptr<LoxFunction>> methods;
 };
\ No newline at end of file
@@ -1,23 +1,23 @@
 #pragma once
 #include <ast/expr.hpp>
-#include <unordered_map>
+#include <vector>
 
+// Environments only hold locals, globals are kept by name in the interpreter.
+// Slots are assigned by the resolver in declaration order, which is the order in which the
+// interpreter defines the variables at runtime.
 class Environment
 {
 public:
-  Environment() {}
   Environment(std::shared_ptr<Environment> enclosing) : enclosing(std::move(enclosing)) {}
 
-  void define(const std::string &name, const expr::Value &value);
-  void define(const std::string &name, expr::Value &&value);
-  void assign(const Token &name, const expr::Value &value);
-  void assign_at(int distance, const std::string &name, const expr::Value &value);
-  expr::Value get(const Token &name) const;
-  expr::Value get_at(int distance, const std::string &name) const;
+  void define(const expr::Value &value);
+  void define(expr::Value &&value);
+  void assign_at(int distance, int slot, const expr::Value &value);
+  expr::Value get_at(int distance, int slot) const;
   std::shared_ptr<Environment> enclosing{};
 
 private:
   const Environment *ancestor(int distance) const;
   Environment *ancestor(int distance);
-  std::unordered_map<std::string, expr::Value> values;
-};
\ No newline at end of file
+  std::vector<expr::Value> values;
+};
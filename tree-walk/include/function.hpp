@@ -22,6 +22,7 @@ public:
   std::shared_ptr<LoxFunction> bind(const std::shared_ptr<LoxInstance> &instance);
 
 private:
+  // shares ownership of the arena the declaration was parsed into
   std::shared_ptr<const stmt::Function> declaration;
   std::shared_ptr<Environment> closure;
   bool is_initializer;
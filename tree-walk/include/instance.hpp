@@ -12,6 +12,6 @@ public:
   void set(const Token &name, const expr::Value &value);
 
 private:
-  std::unordered_map<std::string, expr::Value> fields;
+  LexemeMap<expr::Value> fields;
   std::shared_ptr<LoxClass> klass;
 };
\ No newline at end of file
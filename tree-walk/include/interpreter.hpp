@@ -2,16 +2,12 @@
 #include <ast/stmt.hpp>
 #include <token.hpp>
 #include <environment.hpp>
+#include <unordered_map>
 
-class Interpreter : public expr::Visitor<expr::Value>, public stmt::Visitor<void>
+class Interpreter : public expr::Visitor<expr::Value>, public stmt::Visitor<stmt::Completion>
 {
 public:
-  Interpreter()
-  {
-    globals = std::make_shared<Environment>();
-    environ = globals;
-    define_native_functions();
-  }
+  Interpreter() { define_native_functions(); }
 
   struct RuntimeError : public std::runtime_error {
     RuntimeError(const Token &token, const std::string &message)
@@ -24,34 +20,29 @@ public:
   expr::Value visit_grouping_expr(const expr::Grouping &expr) override;
   expr::Value visit_literal_expr(const expr::Literal &expr) override;
   expr::Value visit_unary_expr(const expr::Unary &expr) override;
-  expr::Value visit_variable_expr(const std::shared_ptr<const expr::Variable> &expr) override;
-  expr::Value visit_assignment_expr(const std::shared_ptr<const expr::Assignment> &expr) override;
+  expr::Value visit_variable_expr(const expr::Variable &expr) override;
+  expr::Value visit_assignment_expr(const expr::Assignment &expr) override;
   expr::Value visit_logical_expr(const expr::Logical &expr) override;
   expr::Value visit_call_expr(const expr::Call &expr) override;
   expr::Value visit_get_expr(const expr::Get &expr) override;
   expr::Value visit_set_expr(const expr::Set &expr) override;
-  expr::Value visit_this_expr(const std::shared_ptr<const expr::This> &expr) override;
-  expr::Value visit_super_expr(const std::shared_ptr<const expr::Super> &expr) override;
-
-  void visit_print_stmt(const stmt::Print &stmt) override;
-  void visit_expr_stmt(const stmt::Expression &stmt) override;
-  void visit_vardecl_stmt(const stmt::VariableDecl &stmt) override;
-  void visit_block_stmt(const stmt::Block &stmt) override;
-  void visit_if_stmt(const stmt::If &stmt) override;
-  void visit_while_stmt(const stmt::While &stmt) override;
-  void visit_fun_stmt(const std::shared_ptr<const stmt::Function> &stmt) override;
-  void visit_return_stmt(const stmt::Return &stmt) override;
-  void visit_class_stmt(const std::shared_ptr<const stmt::Class> &stmt) override;
-
-  void interpret(const std::vector<std::shared_ptr<stmt::StmtBase>> &stms, bool repl = false);
+  expr::Value visit_this_expr(const expr::This &expr) override;
+  expr::Value visit_super_expr(const expr::Super &expr) override;
+
+  stmt::Completion visit_print_stmt(const stmt::Print &stmt) override;
+  stmt::Completion visit_expr_stmt(const stmt::Expression &stmt) override;
+  stmt::Completion visit_vardecl_stmt(const stmt::VariableDecl &stmt) override;
+  stmt::Completion visit_block_stmt(const stmt::Block &stmt) override;
+  stmt::Completion visit_if_stmt(const stmt::If &stmt) override;
+  stmt::Completion visit_while_stmt(const stmt::While &stmt) override;
+  stmt::Completion visit_fun_stmt(const stmt::Function &stmt) override;
+  stmt::Completion visit_return_stmt(const stmt::Return &stmt) override;
+  stmt::Completion visit_class_stmt(const stmt::Class &stmt) override;
+
+  void interpret(const std::vector<stmt::StmtBase *> &stms, bool repl = false);
   static std::string stringify(const expr::Value &value);
-  void execute_block(const std::vector<std::shared_ptr<stmt::StmtBase>> &stmts,
-                     std::unique_ptr<Environment> environ);
-
-  void resolve(std::shared_ptr<const expr::ExprBase> expr, int depth)
-  {
-    locals.emplace(std::move(expr), depth);
-  };
+  stmt::Completion execute_block(const std::vector<stmt::StmtBase *> &stmts,
+                                 std::unique_ptr<Environment> environ);
 
 private:
   void check_number_operand(const Token &op, const expr::Value &operand);
@@ -59,13 +50,13 @@ private:
   bool is_truthy(const expr::Value &value);
   bool is_equal(const expr::Value &left, const expr::Value &right);
   expr::Value evaluate(expr::ExprBase &expr) { return expr.accept(*this); }
-  void execute(const std::shared_ptr<const stmt::StmtBase> &stmt) { return stmt->accept(*this); }
-  expr::Value lookup_variable(const Token &name, const std::shared_ptr<const expr::ExprBase> &expr);
+  stmt::Completion execute(const stmt::StmtBase *stmt) { return stmt->accept(*this); }
+  expr::Value lookup_variable(const Token &name, const expr::Resolved &expr);
+  void define(const Token &name, expr::Value &&value);
   void define_native_functions();
 
-  // distance map updated by resolver
-  std::unordered_map<std::shared_ptr<const expr::ExprBase>, int> locals;
-  std::shared_ptr<Environment> globals;
+  LexemeMap<expr::Value> globals;
+  // null in the global scope
   std::shared_ptr<Environment> environ;
   bool repl{false};
   bool show_exp{false};
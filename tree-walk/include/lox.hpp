@@ -12,7 +12,7 @@ class Lox
 public:
   Lox() = default;
 
-  void run(const std::string &src, bool repl);
+  void run(std::string src, bool repl);
 
   void run_prompt()
   {
@@ -48,13 +48,13 @@ public:
 
   static void error(int line, const std::string &message) { report(line, "", message); }
 
-  static void error(Token token, const std::string &message)
+  static void error(const Token &token, const std::string &message)
   {
     if(token.get_type() == Token::TokenType::END_OF_FILE) {
       Lox::report(token.get_line(), " at end", message);
     }
     else {
-      Lox::report(token.get_line(), " at '" + token.get_lexeme() + "'", message);
+      Lox::report(token.get_line(), " at '" + std::string(token.get_lexeme()) + "'", message);
     }
   }
 
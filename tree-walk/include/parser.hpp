@@ -1,4 +1,5 @@
 #pragma once
+#include <arena.hpp>
 #include <ast/stmt.hpp>
 
 class Parser
@@ -7,11 +8,14 @@ public:
   class ParseError : public std::exception
   {};
 
-  Parser(const std::vector<Token> &tokens, bool repl = false) : tokens(tokens), repl(repl) {}
+  // the nodes of the parsed program are allocated in, and owned by, the given arena
+  Parser(const std::vector<Token> &tokens, Arena &arena, bool repl = false)
+      : arena(arena), repl(repl), tokens(tokens)
+  {}
 
-  std::vector<std::shared_ptr<stmt::StmtBase>> parse()
+  std::vector<stmt::StmtBase *> parse()
   {
-    std::vector<std::shared_ptr<stmt::StmtBase>> statements;
+    std::vector<stmt::StmtBase *> statements;
 
     while(!is_at_end()) {
       statements.push_back(declaration());
@@ -21,40 +25,40 @@ public:
   }
 
 private:
-  ParseError error(Token token, const std::string &message);
-  Token consume(Token::TokenType type, const std::string &message);
+  ParseError error(const Token &token, const std::string &message);
+  const Token &consume(Token::TokenType type, const std::string &message);
   void synchronize();
 
-  std::shared_ptr<expr::ExprBase> equality();
-  std::shared_ptr<expr::ExprBase> comparison();
-  std::shared_ptr<expr::ExprBase> term();
-  std::shared_ptr<expr::ExprBase> factor();
-  std::shared_ptr<expr::ExprBase> unary();
-  std::shared_ptr<expr::ExprBase> primary();
-  std::shared_ptr<expr::ExprBase> assignment();
-  std::shared_ptr<expr::ExprBase> logical_or();
-  std::shared_ptr<expr::ExprBase> logical_and();
-  std::shared_ptr<expr::ExprBase> call();
-  std::shared_ptr<expr::ExprBase> finish_call(std::shared_ptr<expr::ExprBase> callee);
-  std::shared_ptr<expr::ExprBase> expression();
+  expr::ExprBase *equality();
+  expr::ExprBase *comparison();
+  expr::ExprBase *term();
+  expr::ExprBase *factor();
+  expr::ExprBase *unary();
+  expr::ExprBase *primary();
+  expr::ExprBase *assignment();
+  expr::ExprBase *logical_or();
+  expr::ExprBase *logical_and();
+  expr::ExprBase *call();
+  expr::ExprBase *finish_call(expr::ExprBase *callee);
+  expr::ExprBase *expression();
 
-  std::shared_ptr<stmt::Print> print_statement();
-  std::shared_ptr<stmt::Expression> expr_statement(bool parse_semicolon_in_repl = true);
-  std::shared_ptr<stmt::StmtBase> declaration();
-  std::shared_ptr<stmt::VariableDecl> var_declaration();
-  std::shared_ptr<stmt::StmtBase> statement();
-  std::vector<std::shared_ptr<stmt::StmtBase>> block();
-  std::shared_ptr<stmt::If> if_statement();
-  std::shared_ptr<stmt::While> while_statement();
-  std::shared_ptr<stmt::StmtBase> for_statement();
-  std::shared_ptr<stmt::Function> function(std::string kind);
-  std::shared_ptr<stmt::Return> return_statement();
-  std::shared_ptr<stmt::Class> class_declaration();
+  stmt::Print *print_statement();
+  stmt::Expression *expr_statement(bool parse_semicolon_in_repl = true);
+  stmt::StmtBase *declaration();
+  stmt::VariableDecl *var_declaration();
+  stmt::StmtBase *statement();
+  std::vector<stmt::StmtBase *> block();
+  stmt::If *if_statement();
+  stmt::While *while_statement();
+  stmt::StmtBase *for_statement();
+  stmt::Function *function(std::string kind);
+  stmt::Return *return_statement();
+  stmt::Class *class_declaration();
 
   bool is_at_end() { return peek().get_type() == Token::TokenType::END_OF_FILE; }
 
-  Token peek() { return tokens[current]; }
-  Token previous() { return tokens[current - 1]; }
+  const Token &peek() { return tokens[current]; }
+  const Token &previous() { return tokens[current - 1]; }
 
   bool check(Token::TokenType type)
   {
@@ -64,7 +68,7 @@ private:
     return peek().get_type() == type;
   }
 
-  Token advance()
+  const Token &advance()
   {
     if(!is_at_end()) {
       current++;
@@ -84,7 +88,8 @@ private:
   }
 
 private:
+  Arena &arena;
   bool repl;
   size_t current{0};
-  std::vector<Token> tokens;
+  const std::vector<Token> &tokens;
 };
\ No newline at end of file
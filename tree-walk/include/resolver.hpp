@@ -9,19 +9,18 @@ namespace stmt
 class Resolver : public expr::Visitor<void>, public stmt::Visitor<void>
 {
 public:
-  Resolver(Interpreter &interpreter) : interpreter(interpreter) {}
   void visit_binary_expr(const expr::Binary &expr) override;
   void visit_grouping_expr(const expr::Grouping &expr) override;
   void visit_literal_expr(const expr::Literal &expr) override;
   void visit_unary_expr(const expr::Unary &expr) override;
-  void visit_variable_expr(const std::shared_ptr<const expr::Variable> &expr) override;
-  void visit_assignment_expr(const std::shared_ptr<const expr::Assignment> &expr) override;
+  void visit_variable_expr(const expr::Variable &expr) override;
+  void visit_assignment_expr(const expr::Assignment &expr) override;
   void visit_logical_expr(const expr::Logical &expr) override;
   void visit_call_expr(const expr::Call &expr) override;
   void visit_get_expr(const expr::Get &expr) override;
   void visit_set_expr(const expr::Set &expr) override;
-  void visit_this_expr(const std::shared_ptr<const expr::This> &expr) override;
-  void visit_super_expr(const std::shared_ptr<const expr::Super> &expr) override;
+  void visit_this_expr(const expr::This &expr) override;
+  void visit_super_expr(const expr::Super &expr) override;
 
   void visit_print_stmt(const stmt::Print &stmt) override;
   void visit_expr_stmt(const stmt::Expression &stmt) override;
@@ -29,29 +28,34 @@ public:
   void visit_block_stmt(const stmt::Block &stmt) override;
   void visit_if_stmt(const stmt::If &stmt) override;
   void visit_while_stmt(const stmt::While &stmt) override;
-  void visit_fun_stmt(const std::shared_ptr<const stmt::Function> &stmt) override;
+  void visit_fun_stmt(const stmt::Function &stmt) override;
   void visit_return_stmt(const stmt::Return &stmt) override;
-  void visit_class_stmt(const std::shared_ptr<const stmt::Class> &stmt) override;
+  void visit_class_stmt(const stmt::Class &stmt) override;
 
-  void resolve(const std::vector<std::shared_ptr<stmt::StmtBase>> &statements);
+  void resolve(const std::vector<stmt::StmtBase *> &statements);
 
 private:
   enum class FunctionType { NONE, FUNCTION, INITIALIZER, METHOD };
 
   enum class ClassType { NONE, SUBCLASS, CLASS };
 
-  std::vector<std::unordered_map<std::string, bool>> scopes;
-  Interpreter &interpreter;
+  // a local is ready once its initializer has been resolved
+  struct Local {
+    int slot;
+    bool ready;
+  };
+
+  std::vector<std::unordered_map<std::string_view, Local>> scopes;
   FunctionType current_func{FunctionType::NONE};
   ClassType current_class{ClassType::NONE};
 
-  void begin_scope() { scopes.push_back(std::unordered_map<std::string, bool>()); }
+  void begin_scope() { scopes.push_back(std::unordered_map<std::string_view, Local>()); }
   void end_scope() { scopes.pop_back(); }
-  void resolve(const std::shared_ptr<stmt::StmtBase> &stm) { stm->accept(*this); }
-  void resolve(const std::shared_ptr<expr::ExprBase> &expr) { expr->accept(*this); }
+  void resolve(const stmt::StmtBase *stm) { stm->accept(*this); }
+  void resolve(const expr::ExprBase *expr) { expr->accept(*this); }
 
   void declare(const Token &token);
   void define(const Token &token);
-  void resolve_local(const std::shared_ptr<const expr::ExprBase> &expr, const Token &token);
-  void resolve_function(const std::shared_ptr<const stmt::Function> &function, FunctionType type);
+  void resolve_local(const expr::Resolved &expr, const Token &token);
+  void resolve_function(const stmt::Function &function, FunctionType type);
 };
\ No newline at end of file
@@ -6,11 +6,11 @@
 class Scanner
 {
 public:
-  Scanner(std::string source) : source(source) {}
+  Scanner(std::string_view source) : source(source) {}
   [[nodiscard]] std::vector<Token> scan_tokens();
 
 private:
-  const static std::unordered_map<std::string, Token::TokenType> keywords;
+  const static std::unordered_map<std::string_view, Token::TokenType> keywords;
 
   void scan_token();
   bool is_at_end() { return current >= source.size(); }
@@ -37,11 +37,9 @@ private:
     return source[current + 1];
   }
 
-  void add_token(Token::TokenType type) { add_token(type, std::monostate()); }
-
-  void add_token(Token::TokenType type, Token::Literal literal)
+  void add_token(Token::TokenType type)
   {
-    tokens.push_back(Token(type, source.substr(start, current - start), literal, line));
+    tokens.push_back(Token(type, source.substr(start, current - start), line));
   }
 
   void string();
@@ -53,5 +51,5 @@ private:
   std::vector<Token> tokens;
   size_t start{0};
   size_t current{0};
-  std::string source;
+  std::string_view source;
 };
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Immutable string value of Lox. Strings are interned, like in clox: equal contents always
+// share the same storage, so a copy is a reference count bump and equality a pointer compare.
+// The hash is computed once, when the contents are first interned.
+class LoxString
+{
+public:
+  explicit LoxString(std::string_view chars);
+  LoxString(const LoxString &other) : data(other.data) { data->refs++; }
+  LoxString(LoxString &&other) noexcept : data(other.data) { other.data = nullptr; }
+  LoxString &operator=(LoxString other) noexcept
+  {
+    std::swap(data, other.data);
+    return *this;
+  }
+  ~LoxString()
+  {
+    if(data != nullptr && --data->refs == 0) {
+      release(data);
+    }
+  }
+
+  const std::string &str() const { return data->chars; }
+  std::size_t hash() const { return data->hash; }
+  bool operator==(const LoxString &other) const { return data == other.data; }
+  LoxString operator+(const LoxString &other) const;
+
+private:
+  struct Data {
+    std::string chars;
+    std::size_t hash;
+    // the interpreter is single threaded, no need for an atomic count
+    std::size_t refs;
+  };
+  // the intern table is keyed by the contents of its entries and their precomputed hash
+  struct Key {
+    std::string_view chars;
+    std::size_t hash;
+    bool operator==(const Key &other) const { return chars == other.chars; }
+  };
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const noexcept { return key.hash; }
+  };
+  static std::unordered_map<Key, Data *, KeyHash> &strings();
+  static void release(Data *data);
+
+  Data *data;
+};
+
+template <> struct std::hash<LoxString> {
+  std::size_t operator()(const LoxString &s) const noexcept { return s.hash(); }
+};
@@ -1,11 +1,14 @@
 #pragma once
+#include <functional>
 #include <string>
-#include <variant>
+#include <string_view>
+#include <unordered_map>
 
+// Tokens don't own anything: the lexeme views the source, which is kept alive as long as the
+// program parsed from it (see Lox::run). Literal values are only built by the parser.
 class Token
 {
 public:
-  using Literal = std::variant<std::monostate, double, std::string, bool>;
 
   enum class TokenType {
     // single character tokens
@@ -57,17 +60,16 @@ public:
     END_OF_FILE,
   };
 
-  Token(TokenType type, std::string lexeme, Literal literal, int line)
-      : type(type), lexeme(lexeme), literal(literal), line(line)
-  {}
+  Token(TokenType type, std::string_view lexeme, int line) : type(type), lexeme(lexeme), line(line) {}
 
-  [[nodiscard]] std::string to_string() const { return "[" + name(type) + ", " + lexeme + "]"; }
+  [[nodiscard]] std::string to_string() const
+  {
+    return "[" + name(type) + ", " + std::string(lexeme) + "]";
+  }
 
   [[nodiscard]] TokenType get_type() const { return type; }
 
-  [[nodiscard]] std::string get_lexeme() const { return lexeme; }
-
-  [[nodiscard]] Literal get_literal() const { return literal; }
+  [[nodiscard]] std::string_view get_lexeme() const { return lexeme; }
 
   [[nodiscard]] int get_line() const { return line; }
 
@@ -120,7 +122,18 @@ private:
 
 private:
   TokenType type;
-  std::string lexeme;
-  Literal literal;
+  std::string_view lexeme;
   int line;
-};
\ No newline at end of file
+};
+
+// Maps keyed by name that can be searched with a lexeme, without building a string.
+struct LexemeHash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view s) const noexcept
+  {
+    return std::hash<std::string_view>{}(s);
+  }
+};
+
+template <typename T>
+using LexemeMap = std::unordered_map<std::string, T, LexemeHash, std::equal_to<>>;
\ No newline at end of file
@@ -24,15 +24,14 @@ namespace expr
     T virtual visit_grouping_expr(const Grouping &expr) = 0;
     T virtual visit_literal_expr(const Literal &expr) = 0;
     T virtual visit_unary_expr(const Unary &expr) = 0;
-    // shared ptr required to resolve a variable by ptr value
-    T virtual visit_variable_expr(const std::shared_ptr<const Variable> &expr) = 0;
-    T virtual visit_assignment_expr(const std::shared_ptr<const Assignment> &expr) = 0;
+    T virtual visit_variable_expr(const Variable &expr) = 0;
+    T virtual visit_assignment_expr(const Assignment &expr) = 0;
     T virtual visit_logical_expr(const Logical &expr) = 0;
     T virtual visit_call_expr(const Call &expr) = 0;
     T virtual visit_get_expr(const Get &expr) = 0;
     T virtual visit_set_expr(const Set &expr) = 0;
-    T virtual visit_this_expr(const std::shared_ptr<const This> &expr) = 0;
-    T virtual visit_super_expr(const std::shared_ptr<const Super> &expr) = 0;
+    T virtual visit_this_expr(const This &expr) = 0;
+    T virtual visit_super_expr(const Super &expr) = 0;
   };
 }
 
@@ -58,10 +57,8 @@ namespace stmt
     T virtual visit_block_stmt(const Block &stmt) = 0;
     T virtual visit_if_stmt(const If &stmt) = 0;
     T virtual visit_while_stmt(const While &stmt) = 0;
-    // shared ptr required to save the function declaration in the environment
-    T virtual visit_fun_stmt(const std::shared_ptr<const Function> &stmt) = 0;
+    T virtual visit_fun_stmt(const Function &stmt) = 0;
     T virtual visit_return_stmt(const Return &stmt) = 0;
-    // shared ptr required to save the class declaration in the environment
-    T virtual visit_class_stmt(const std::shared_ptr<const Class> &stmt) = 0;
+    T virtual visit_class_stmt(const Class &stmt) = 0;
   };
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#include <algorithm>
+#include <arena.hpp>
+#include <cstdint>
+
+static std::byte *align_up(std::byte *p, std::size_t align)
+{
+  auto address = reinterpret_cast<std::uintptr_t>(p);
+  return reinterpret_cast<std::byte *>((address + align - 1) & ~(align - 1));
+}
+
+Arena::~Arena()
+{
+  for(auto it = destructors.rbegin(); it != destructors.rend(); ++it) {
+    it->second(it->first);
+  }
+}
+
+void *Arena::allocate(std::size_t size, std::size_t align)
+{
+  auto p = align_up(next, align);
+  if(next == nullptr || p + size > end) {
+    // nodes are small: an oversized request just gets a block of its own
+    auto capacity = std::max(block_size, size + align);
+    blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(capacity));
+    next = blocks.back().get();
+    end = next + capacity;
+    p = align_up(next, align);
+  }
+  next = p + size;
+  return p;
+}
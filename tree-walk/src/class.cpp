@@ -13,10 +13,11 @@ expr::Value LoxClass::call(Interpreter &interpreter, const std::vector<expr::Val
   return instance;
 }
 
-std::shared_ptr<LoxFunction> LoxClass::find_method(const std::string &name) const
+std::shared_ptr<LoxFunction> LoxClass::find_method(std::string_view name) const
 {
-  if(methods.find(name) != methods.end()) {
-    return methods.at(name);
+  auto it = methods.find(name);
+  if(it != methods.end()) {
+    return it->second;
   }
 
   // else look in the superclass
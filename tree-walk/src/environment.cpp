@@ -1,23 +1,8 @@
 #include <environment.hpp>
-#include <interpreter.hpp>
 
-expr::Value Environment::get(const Token &name) const
+expr::Value Environment::get_at(int distance, int slot) const
 {
-  auto it = values.find(name.get_lexeme());
-  if(it != values.end()) {
-    return it->second;
-  }
-
-  if(enclosing != nullptr) {
-    return enclosing->get(name);
-  }
-
-  throw Interpreter::RuntimeError(name, "Undefined variable '" + name.get_lexeme() + "'.");
-}
-
-expr::Value Environment::get_at(int distance, const std::string &name) const
-{
-  return ancestor(distance)->values.at(name);
+  return ancestor(distance)->values[slot];
 }
 
 const Environment *Environment::ancestor(int distance) const
@@ -35,32 +20,11 @@ Environment *Environment::ancestor(int distance)
   return const_cast<Environment *>(const_cast<const Environment *>(this)->ancestor(distance));
 }
 
-void Environment::define(const std::string &name, const expr::Value &value)
-{
-  values[name] = value;
-}
+void Environment::define(const expr::Value &value) { values.push_back(value); }
 
-void Environment::define(const std::string &name, expr::Value &&value)
-{
-  values.insert_or_assign(name, std::move(value));
-}
+void Environment::define(expr::Value &&value) { values.push_back(std::move(value)); }
 
-void Environment::assign(const Token &name, const expr::Value &value)
+void Environment::assign_at(int distance, int slot, const expr::Value &value)
 {
-  if(values.find(name.get_lexeme()) != values.end()) {
-    values[name.get_lexeme()] = value;
-    return;
-  }
-
-  if(enclosing != nullptr) {
-    enclosing->assign(name, value);
-    return;
-  }
-
-  throw Interpreter::RuntimeError(name, "Undefined variable '" + name.get_lexeme() + "'.");
+  ancestor(distance)->values[slot] = value;
 }
-
-void Environment::assign_at(int distance, const std::string &name, const expr::Value &value)
-{
-  ancestor(distance)->values[name] = value;
-}
\ No newline at end of file
@@ -16,10 +16,17 @@ expr::Value LoxInstance::get(const Token &name)
     return expr::Value(method->bind(shared_from_this()));
   }
 
-  throw Interpreter::RuntimeError(name, "Undefined property '" + name.get_lexeme() + "'.");
+  throw Interpreter::RuntimeError(name,
+                                  "Undefined property '" + std::string(name.get_lexeme()) + "'.");
 }
 
 void LoxInstance::set(const Token &name, const expr::Value &value)
 {
-  fields[name.get_lexeme()] = value;
+  auto it = fields.find(name.get_lexeme());
+  if(it != fields.end()) {
+    it->second = value;
+  }
+  else {
+    fields.emplace(name.get_lexeme(), value);
+  }
 }
\ No newline at end of file
@@ -1,9 +1,9 @@
+#include <arena.hpp>
 #include <chrono>
 #include <class.hpp>
 #include <instance.hpp>
 #include <function.hpp>
 #include <lox.hpp>
-#include <return.hpp>
 
 expr::Value Interpreter::visit_binary_expr(const expr::Binary &expr)
 {
@@ -28,7 +28,7 @@ expr::Value Interpreter::visit_binary_expr(const expr::Binary &expr)
       return std::get<double>(left.v) + std::get<double>(right.v);
     }
     else if(left.is_string() && right.is_string()) {
-      return std::get<std::string>(left.v) + std::get<std::string>(right.v);
+      return left.as<LoxString>() + right.as<LoxString>();
     }
     throw RuntimeError(expr.op, "Operands must be two numbers or two strings.");
 
@@ -85,7 +85,7 @@ bool Interpreter::is_equal(const expr::Value &left, const expr::Value &right)
     return std::get<double>(left.v) == std::get<double>(right.v);
   }
   else if(left.is_string() && right.is_string()) {
-    return std::get<std::string>(left.v) == std::get<std::string>(right.v);
+    return left.as<LoxString>() == right.as<LoxString>();
   }
   else if(left.is_bool() && right.is_bool()) {
     return std::get<bool>(left.v) == std::get<bool>(right.v);
@@ -139,7 +139,7 @@ std::string Interpreter::stringify(const expr::Value &value)
     return std::format("{}", value.as<double>());
   }
   else if(value.is_string()) {
-    return value.as<std::string>();
+    return value.as<LoxString>().str();
   }
   else if(value.is_bool()) {
     return value.as<bool>() ? "true" : "false";
@@ -153,37 +153,44 @@ std::string Interpreter::stringify(const expr::Value &value)
   return "???unknown???";
 }
 
-void Interpreter::visit_print_stmt(const stmt::Print &stmt)
+stmt::Completion Interpreter::visit_print_stmt(const stmt::Print &stmt)
 {
-  auto value = evaluate(*stmt.ex.get());
+  auto value = evaluate(*stmt.ex);
   std::cout << stringify(value) << std::endl;
+  return {};
 }
 
-void Interpreter::visit_expr_stmt(const stmt::Expression &stmt)
+stmt::Completion Interpreter::visit_expr_stmt(const stmt::Expression &stmt)
 {
   show_exp = true;
-  auto v = evaluate(*stmt.ex.get());
+  auto v = evaluate(*stmt.ex);
   if(repl && show_exp) {
     std::cout << stringify(v) << std::endl;
   }
+  return {};
 }
 
-expr::Value Interpreter::visit_variable_expr(const std::shared_ptr<const expr::Variable> &expr)
+expr::Value Interpreter::visit_variable_expr(const expr::Variable &expr)
 {
-  return lookup_variable(expr->token, expr);
+  return lookup_variable(expr.token, expr);
 }
 
-expr::Value Interpreter::visit_assignment_expr(const std::shared_ptr<const expr::Assignment> &expr)
+expr::Value Interpreter::visit_assignment_expr(const expr::Assignment &expr)
 {
   show_exp = false;
-  auto value = evaluate(*expr->value);
+  auto value = evaluate(*expr.value);
 
-  if(locals.find(expr) != locals.end()) {
-    environ->assign_at(locals[expr], expr->token.get_lexeme(), value);
+  if(expr.depth != -1) {
+    environ->assign_at(expr.depth, expr.slot, value);
+    return value;
   }
-  else {
-    globals->assign(expr->token, value);
+
+  auto global = globals.find(expr.token.get_lexeme());
+  if(global == globals.end()) {
+    throw RuntimeError(expr.token,
+                       "Undefined variable '" + std::string(expr.token.get_lexeme()) + "'.");
   }
+  global->second = value;
   return value;
 }
 
@@ -225,7 +232,7 @@ expr::Value Interpreter::visit_call_expr(const expr::Call &expr)
   return func.call(*this, args);
 }
 
-void Interpreter::visit_vardecl_stmt(const stmt::VariableDecl &stmt)
+stmt::Completion Interpreter::visit_vardecl_stmt(const stmt::VariableDecl &stmt)
 {
   // by default, if a variable declaration has no initializer, the value is nil
   show_exp = false;
@@ -234,55 +241,71 @@ void Interpreter::visit_vardecl_stmt(const stmt::VariableDecl &stmt)
     value = evaluate(*stmt.initializer);
   }
 
-  environ->define(stmt.token.get_lexeme(), value);
+  define(stmt.token, std::move(value));
+  return {};
 }
 
-void Interpreter::visit_block_stmt(const stmt::Block &stmt)
+stmt::Completion Interpreter::visit_block_stmt(const stmt::Block &stmt)
 {
-  execute_block(stmt.statements, std::make_unique<Environment>(environ));
+  return execute_block(stmt.statements, std::make_unique<Environment>(environ));
 }
 
-void Interpreter::visit_if_stmt(const stmt::If &stmt)
+stmt::Completion Interpreter::visit_if_stmt(const stmt::If &stmt)
 {
   if(is_truthy(evaluate(*stmt.condition))) {
-    execute(stmt.then_stm);
+    return execute(stmt.then_stm);
   }
   else if(stmt.else_stm != nullptr) {
-    execute(std::shared_ptr<stmt::StmtBase>(stmt.else_stm));
+    return execute(stmt.else_stm);
   }
+  return {};
 }
 
-void Interpreter::visit_while_stmt(const stmt::While &stmt)
+stmt::Completion Interpreter::visit_while_stmt(const stmt::While &stmt)
 {
   while(is_truthy(evaluate(*stmt.condition))) {
-    execute(stmt.body);
+    auto completion = execute(stmt.body);
+    if(completion.type == stmt::Completion::Type::RETURN) {
+      return completion;
+    }
   }
+  return {};
 }
 
-void Interpreter::visit_fun_stmt(const std::shared_ptr<const stmt::Function> &stmt)
+// A function shares ownership of the arena holding its declaration, so that the nodes outlive
+// the REPL line that declared them.
+static std::shared_ptr<const stmt::Function> keep_alive(const stmt::Function &declaration)
 {
-  auto func = std::make_shared<LoxFunction>(stmt, environ, false);
-  environ->define(stmt->name.get_lexeme(), expr::Value(func));
+  return {declaration.arena.shared_from_this(), &declaration};
 }
 
-void Interpreter::visit_return_stmt(const stmt::Return &stmt)
+stmt::Completion Interpreter::visit_fun_stmt(const stmt::Function &stmt)
 {
+  auto func = std::make_shared<LoxFunction>(keep_alive(stmt), environ, false);
+  define(stmt.name, expr::Value(func));
+  return {};
+}
+
+stmt::Completion Interpreter::visit_return_stmt(const stmt::Return &stmt)
+{
+  // the enclosing statements stop executing and hand this over up to LoxFunction::call
+  stmt::Completion completion{stmt::Completion::Type::RETURN};
   if(stmt.value != nullptr) {
-    throw Return(evaluate(*stmt.value));
+    completion.value = evaluate(*stmt.value);
   }
   // by default 'return;' returns nil
-  throw Return(expr::Value());
+  return completion;
 }
 
-void Interpreter::visit_class_stmt(const std::shared_ptr<const stmt::Class> &stmt)
+stmt::Completion Interpreter::visit_class_stmt(const stmt::Class &stmt)
 {
   // validate the superclass if any
   std::shared_ptr<const LoxClass> superclass{};
-  if(stmt->superclass != nullptr) {
-    auto super = evaluate(*stmt->superclass);
+  if(stmt.superclass != nullptr) {
+    auto super = evaluate(*stmt.superclass);
     if(!super.is_callable()
        || typeid(*super.as<std::shared_ptr<LoxCallable>>()) != typeid(LoxClass)) {
-      throw RuntimeError(stmt->superclass->token, "Superclass must be a class.");
+      throw RuntimeError(stmt.superclass->token, "Superclass must be a class.");
     }
 
     auto &callable = super.as<std::shared_ptr<LoxCallable>>();
@@ -291,24 +314,27 @@ void Interpreter::visit_class_stmt(const std::shared_ptr<const stmt::Class> &stm
     // wrap the environment in another one containing the superclass
     // this environment will be passed to methods
     environ = std::make_shared<Environment>(environ);
-    environ->define("super", callable);
+    environ->define(callable);
   }
 
-  std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods;
-  for(auto &method : stmt->methods) {
+  LexemeMap<std::shared_ptr<LoxFunction>> methods;
+  for(auto &method : stmt.methods) {
     // each method is turned into the runtime representation
     auto lexeme = method->name.get_lexeme();
-    methods[lexeme] = std::make_shared<LoxFunction>(method, environ, lexeme == "init");
+    methods.insert_or_assign(
+      std::string(lexeme),
+      std::make_shared<LoxFunction>(keep_alive(*method), environ, lexeme == "init"));
   }
 
-  if(stmt->superclass != nullptr) {
+  if(stmt.superclass != nullptr) {
     // pop the superclass environment
     environ = environ->enclosing;
   }
 
-  auto klass = std::make_shared<LoxClass>(stmt->name.get_lexeme(), std::move(superclass),
-                                          std::move(methods));
-  environ->define(stmt->name.get_lexeme(), expr::Value(klass));
+  auto klass = std::make_shared<LoxClass>(std::string(stmt.name.get_lexeme()),
+                                          std::move(superclass), std::move(methods));
+  define(stmt.name, expr::Value(klass));
+  return {};
 }
 
 expr::Value Interpreter::visit_get_expr(const expr::Get &expr)
@@ -333,16 +359,17 @@ expr::Value Interpreter::visit_set_expr(const expr::Set &expr)
   throw RuntimeError(expr.name, "Only instances have fields.");
 }
 
-expr::Value Interpreter::visit_this_expr(const std::shared_ptr<const expr::This> &expr)
+expr::Value Interpreter::visit_this_expr(const expr::This &expr)
 {
-  return lookup_variable(expr->token, expr);
+  return lookup_variable(expr.token, expr);
 }
 
-expr::Value Interpreter::visit_super_expr(const std::shared_ptr<const expr::Super> &expr)
+expr::Value Interpreter::visit_super_expr(const expr::Super &expr)
 {
-  int distance = locals[expr];
-  auto superclass_value = environ->get_at(distance, "super");
-  auto instance_value = environ->get_at(distance - 1, "this"); // not elegant but it works
+  // `super` and `this` are the only variables of their environments
+  int distance = expr.depth;
+  auto superclass_value = environ->get_at(distance, 0);
+  auto instance_value = environ->get_at(distance - 1, 0); // not elegant but it works
 
   // retrieve the instance and the superclass
   auto &instance = instance_value.as<std::shared_ptr<LoxInstance>>();
@@ -350,35 +377,36 @@ expr::Value Interpreter::visit_super_expr(const std::shared_ptr<const expr::Supe
     superclass_value.as<std::shared_ptr<LoxCallable>>());
 
   // retrieve the method from the superclass
-  auto method = superclass->find_method(expr->method.get_lexeme());
+  auto method = superclass->find_method(expr.method.get_lexeme());
 
   // does it exist?
   if(method == nullptr) {
-    throw RuntimeError(expr->method, "Undefined property '" + expr->method.get_lexeme() + "'.");
+    throw RuntimeError(expr.method,
+                       "Undefined property '" + std::string(expr.method.get_lexeme()) + "'.");
   }
 
   // bind the method to the `this` instance
   return expr::Value(method->bind(instance));
 }
 
-void Interpreter::execute_block(const std::vector<std::shared_ptr<stmt::StmtBase>> &stmts,
-                                std::unique_ptr<Environment> env)
+stmt::Completion Interpreter::execute_block(const std::vector<stmt::StmtBase *> &stmts,
+                                            std::unique_ptr<Environment> env)
 {
-  auto previous = environ;
-  try {
-    environ = std::move(env);
-    for(auto &stm : stmts) {
-      execute(stm);
+  // a runtime error leaves the block without restoring the environment: interpret() resets it
+  auto previous = std::move(environ);
+  environ = std::move(env);
+  for(auto &stm : stmts) {
+    auto completion = execute(stm);
+    if(completion.type == stmt::Completion::Type::RETURN) {
+      environ = std::move(previous);
+      return completion;
     }
   }
-  catch(...) {
-    environ = previous;
-    throw;
-  }
-  environ = previous;
+  environ = std::move(previous);
+  return {};
 }
 
-void Interpreter::interpret(const std::vector<std::shared_ptr<stmt::StmtBase>> &stms, bool repl)
+void Interpreter::interpret(const std::vector<stmt::StmtBase *> &stms, bool repl)
 {
   this->repl = repl;
   try {
@@ -387,18 +415,33 @@ void Interpreter::interpret(const std::vector<std::shared_ptr<stmt::StmtBase>> &
     }
   }
   catch(const RuntimeError &error) {
+    // back to the global scope, for the next line of the REPL
+    environ = nullptr;
     Lox::runtime_error(error);
   }
 }
 
-expr::Value Interpreter::lookup_variable(const Token &name,
-                                         const std::shared_ptr<const expr::ExprBase> &expr)
+expr::Value Interpreter::lookup_variable(const Token &name, const expr::Resolved &expr)
+{
+  if(expr.depth != -1) {
+    return environ->get_at(expr.depth, expr.slot);
+  }
+
+  auto global = globals.find(name.get_lexeme());
+  if(global == globals.end()) {
+    throw RuntimeError(name, "Undefined variable '" + std::string(name.get_lexeme()) + "'.");
+  }
+  return global->second;
+}
+
+void Interpreter::define(const Token &name, expr::Value &&value)
 {
-  if(locals.find(expr) == locals.end()) {
-    return globals->get(name);
+  if(environ == nullptr) {
+    // globals can be redefined
+    globals.insert_or_assign(std::string(name.get_lexeme()), std::move(value));
   }
   else {
-    return environ->get(name);
+    environ->define(std::move(value));
   }
 }
 
@@ -418,5 +461,5 @@ void Interpreter::define_native_functions()
   };
 
   auto f = std::make_shared<NativeFunctionClock>();
-  globals->define("clock", expr::Value(f));
+  globals.emplace("clock", expr::Value(f));
 }
\ No newline at end of file
@@ -7,24 +7,29 @@
 bool Lox::had_error{false};
 bool Lox::had_runtime_error{false};
 
-void Lox::run(const std::string &src, bool repl)
+void Lox::run(std::string src, bool repl)
 
 {
-  Scanner scanner(src);
+  // every run gets its own arena: functions declared in it keep it alive past this call.
+  // Tokens and nodes view the source, so it is pinned in the arena as well
+  auto arena = std::make_shared<Arena>();
+  auto source = arena->make<std::string>(std::move(src));
+
+  Scanner scanner(*source);
   std::vector<Token> tokens = scanner.scan_tokens();
 
   if(had_error) {
     return;
   }
 
-  Parser parser(tokens, repl);
+  Parser parser(tokens, *arena, repl);
   auto statements = parser.parse();
 
   if(had_error) {
     return;
   }
 
-  Resolver resolver(interpreter);
+  Resolver resolver;
   resolver.resolve(statements);
 
   if(had_error) {
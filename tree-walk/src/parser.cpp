@@ -1,98 +1,108 @@
+#include <charconv>
 #include <lox.hpp>
 #include <parser.hpp>
 
-std::shared_ptr<expr::ExprBase> Parser::expression() { return assignment(); }
+expr::ExprBase *Parser::expression() { return assignment(); }
 
-std::shared_ptr<expr::ExprBase> Parser::equality()
+expr::ExprBase *Parser::equality()
 {
   auto expr = comparison();
   while(match(Token::TokenType::BANG_EQUAL, Token::TokenType::EQUAL_EQUAL)) {
     auto op = previous();
     auto right = comparison();
-    expr = std::make_shared<expr::Binary>(std::move(expr), op, std::move(right));
+    expr = arena.make<expr::Binary>(expr, op, right);
   }
   return expr;
 }
 
-std::shared_ptr<expr::ExprBase> Parser::comparison()
+expr::ExprBase *Parser::comparison()
 {
   auto expr = term();
   while(match(Token::TokenType::GREATER, Token::TokenType::GREATER_EQUAL, Token::TokenType::LESS,
               Token::TokenType::LESS_EQUAL)) {
     auto op = previous();
     auto right = term();
-    expr = std::make_shared<expr::Binary>(std::move(expr), op, std::move(right));
+    expr = arena.make<expr::Binary>(expr, op, right);
   }
   return expr;
 }
 
-std::shared_ptr<expr::ExprBase> Parser::term()
+expr::ExprBase *Parser::term()
 {
   auto expr = factor();
   while(match(Token::TokenType::MINUS, Token::TokenType::PLUS)) {
     auto op = previous();
     auto right = factor();
-    expr = std::make_shared<expr::Binary>(std::move(expr), op, std::move(right));
+    expr = arena.make<expr::Binary>(expr, op, right);
   }
   return expr;
 }
 
-std::shared_ptr<expr::ExprBase> Parser::factor()
+expr::ExprBase *Parser::factor()
 {
   auto expr = unary();
   while(match(Token::TokenType::SLASH, Token::TokenType::STAR)) {
     auto op = previous();
     auto right = unary();
-    expr = std::make_shared<expr::Binary>(std::move(expr), op, std::move(right));
+    expr = arena.make<expr::Binary>(expr, op, right);
   }
   return expr;
 }
 
-std::shared_ptr<expr::ExprBase> Parser::unary()
+expr::ExprBase *Parser::unary()
 {
   if(match(Token::TokenType::BANG, Token::TokenType::MINUS)) {
     auto op = previous();
     auto right = unary();
-    return std::make_shared<expr::Unary>(op, std::move(right));
+    return arena.make<expr::Unary>(op, right);
   }
   return call();
 }
 
-std::shared_ptr<expr::ExprBase> Parser::primary()
+expr::ExprBase *Parser::primary()
 {
   if(match(Token::TokenType::FALSE)) {
-    return std::make_shared<expr::Literal>(Token::Literal{false});
+    return arena.make<expr::Literal>(expr::Value(false));
   }
   else if(match(Token::TokenType::TRUE)) {
-    return std::make_shared<expr::Literal>(Token::Literal{true});
+    return arena.make<expr::Literal>(expr::Value(true));
   }
   else if(match(Token::TokenType::NIL)) {
-    return std::make_shared<expr::Literal>(Token::Literal{});
+    return arena.make<expr::Literal>(expr::Value());
   }
-  else if(match(Token::TokenType::NUMBER, Token::TokenType::STRING)) {
-    return std::make_shared<expr::Literal>(previous().get_literal());
+  else if(match(Token::TokenType::NUMBER)) {
+    // the scanner only accepts digits with an optional fractional part: this can't fail
+    auto lexeme = previous().get_lexeme();
+    double number{};
+    std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), number);
+    return arena.make<expr::Literal>(expr::Value(number));
+  }
+  else if(match(Token::TokenType::STRING)) {
+    // trim the surrounding quotes
+    auto lexeme = previous().get_lexeme();
+    return arena.make<expr::Literal>(expr::Value(LoxString(lexeme.substr(1, lexeme.size() - 2))));
   }
   else if(match(Token::TokenType::IDENTIFIER)) {
-    return std::make_shared<expr::Variable>(previous());
+    return arena.make<expr::Variable>(previous());
   }
   else if(match(Token::TokenType::LEFT_PAREN)) {
     auto expr = expression();
     consume(Token::TokenType::RIGHT_PAREN, "Expect ')' after expression.");
-    return std::make_shared<expr::Grouping>(std::move(expr));
+    return arena.make<expr::Grouping>(expr);
   }
   else if(match(Token::TokenType::THIS)) {
-    return std::make_shared<expr::This>(previous());
+    return arena.make<expr::This>(previous());
   }
   else if(match(Token::TokenType::SUPER)) {
     auto keyword = previous();
     consume(Token::TokenType::DOT, "Expect '.' after 'super'.");
     auto method = consume(Token::TokenType::IDENTIFIER, "Expect superclass method name.");
-    return std::make_shared<expr::Super>(keyword, method);
+    return arena.make<expr::Super>(keyword, method);
   }
   throw error(peek(), "Expect expression.");
 }
 
-std::shared_ptr<expr::ExprBase> Parser::assignment()
+expr::ExprBase *Parser::assignment()
 {
   // trick: parse the left side as a single expression so that we automatically stop
   // at the first '='
@@ -104,50 +114,50 @@ std::shared_ptr<expr::ExprBase> Parser::assignment()
 
     if(typeid(*expr) == typeid(expr::Variable)) {
       auto &name = dynamic_cast<expr::Variable &>(*expr);
-      return std::make_shared<expr::Assignment>(name.token, std::move(value));
+      return arena.make<expr::Assignment>(name.token, value);
     }
     else if(typeid(*expr) == typeid(expr::Get)) {
       auto &get = dynamic_cast<expr::Get &>(*expr);
       // this is actually a set expression, so change the node type
-      return std::make_shared<expr::Set>(std::move(get.object), get.name, std::move(value));
+      return arena.make<expr::Set>(get.object, get.name, value);
     }
     error(equals, "Invalid assignment target.");
   }
   return expr;
 }
 
-std::shared_ptr<expr::ExprBase> Parser::logical_or()
+expr::ExprBase *Parser::logical_or()
 {
   auto expr = logical_and();
   while(match(Token::TokenType::OR)) {
     auto op = previous();
     auto right = logical_and();
-    expr = std::make_shared<expr::Logical>(std::move(expr), op, std::move(right));
+    expr = arena.make<expr::Logical>(expr, op, right);
   }
   return expr;
 }
-std::shared_ptr<expr::ExprBase> Parser::logical_and()
+expr::ExprBase *Parser::logical_and()
 {
   auto expr = equality();
   while(match(Token::TokenType::AND)) {
     auto op = previous();
     auto right = equality();
-    expr = std::make_shared<expr::Logical>(std::move(expr), op, std::move(right));
+    expr = arena.make<expr::Logical>(expr, op, right);
   }
   return expr;
 }
 
-std::shared_ptr<expr::ExprBase> Parser::call()
+expr::ExprBase *Parser::call()
 {
   auto expr = primary();
 
   while(true) {
     if(match(Token::TokenType::LEFT_PAREN)) {
-      expr = finish_call(std::move(expr));
+      expr = finish_call(expr);
     }
     else if(match(Token::TokenType::DOT)) {
       auto name = consume(Token::TokenType::IDENTIFIER, "Expect property name after '.'.");
-      expr = std::make_shared<expr::Get>(std::move(expr), name);
+      expr = arena.make<expr::Get>(expr, name);
     }
     else {
       break;
@@ -156,9 +166,9 @@ std::shared_ptr<expr::ExprBase> Parser::call()
   return expr;
 }
 
-std::shared_ptr<expr::ExprBase> Parser::finish_call(std::shared_ptr<expr::ExprBase> callee)
+expr::ExprBase *Parser::finish_call(expr::ExprBase *callee)
 {
-  std::vector<std::shared_ptr<expr::ExprBase>> arguments;
+  std::vector<expr::ExprBase *> arguments;
   if(!check(Token::TokenType::RIGHT_PAREN)) {
     do {
       if(arguments.size() >= 255) {
@@ -170,16 +180,16 @@ std::shared_ptr<expr::ExprBase> Parser::finish_call(std::shared_ptr<expr::ExprBa
     } while(match(Token::TokenType::COMMA));
   }
   auto paren = consume(Token::TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
-  return std::make_shared<expr::Call>(std::move(callee), paren, std::move(arguments));
+  return arena.make<expr::Call>(callee, paren, std::move(arguments));
 }
 
-Parser::ParseError Parser::error(Token token, const std::string &message)
+Parser::ParseError Parser::error(const Token &token, const std::string &message)
 {
   Lox::error(token, message);
   return ParseError();
 }
 
-Token Parser::consume(Token::TokenType type, const std::string &message)
+const Token &Parser::consume(Token::TokenType type, const std::string &message)
 {
   if(check(type)) {
     return advance();
@@ -189,7 +199,7 @@ Token Parser::consume(Token::TokenType type, const std::string &message)
   }
 }
 
-std::shared_ptr<stmt::StmtBase> Parser::statement()
+stmt::StmtBase *Parser::statement()
 {
   if(match(Token::TokenType::PRINT)) {
     return print_statement();
@@ -207,7 +217,7 @@ std::shared_ptr<stmt::StmtBase> Parser::statement()
     // why not just block()?
     // because block() is used to parse function blocks and we don't want the result to
     // be embedded in a stmt::Block
-    return std::make_shared<stmt::Block>(block());
+    return arena.make<stmt::Block>(block());
   }
   else if(match(Token::TokenType::IF)) {
     return if_statement();
@@ -215,23 +225,23 @@ std::shared_ptr<stmt::StmtBase> Parser::statement()
   return expr_statement(false);
 }
 
-std::shared_ptr<stmt::Print> Parser::print_statement()
+stmt::Print *Parser::print_statement()
 {
   auto expr = expression();
   consume(Token::TokenType::SEMICOLON, "Expect ';' after value.");
-  return std::make_shared<stmt::Print>(std::move(expr));
+  return arena.make<stmt::Print>(expr);
 }
 
-std::shared_ptr<stmt::Expression> Parser::expr_statement(bool parse_semicolon_in_repl)
+stmt::Expression *Parser::expr_statement(bool parse_semicolon_in_repl)
 {
   auto expr = expression();
   if(!repl || parse_semicolon_in_repl || peek().get_type() == Token::TokenType::SEMICOLON) {
     consume(Token::TokenType::SEMICOLON, "Expect ';' after expression.");
   }
-  return std::make_shared<stmt::Expression>(std::move(expr));
+  return arena.make<stmt::Expression>(expr);
 }
 
-std::shared_ptr<stmt::StmtBase> Parser::declaration()
+stmt::StmtBase *Parser::declaration()
 {
   try {
     if(match(Token::TokenType::VAR)) {
@@ -251,22 +261,22 @@ std::shared_ptr<stmt::StmtBase> Parser::declaration()
   }
 }
 
-std::shared_ptr<stmt::VariableDecl> Parser::var_declaration()
+stmt::VariableDecl *Parser::var_declaration()
 {
   Token name = consume(Token::TokenType::IDENTIFIER, "Expect variable name.");
-  std::shared_ptr<expr::ExprBase> initializer{};
+  expr::ExprBase *initializer{};
 
   if(match(Token::TokenType::EQUAL)) {
     initializer = expression();
   }
 
   consume(Token::TokenType::SEMICOLON, "Expect ';' after variable declaration.");
-  return std::make_shared<stmt::VariableDecl>(name, std::move(initializer));
+  return arena.make<stmt::VariableDecl>(name, initializer);
 }
 
-std::vector<std::shared_ptr<stmt::StmtBase>> Parser::block()
+std::vector<stmt::StmtBase *> Parser::block()
 {
-  std::vector<std::shared_ptr<stmt::StmtBase>> statements;
+  std::vector<stmt::StmtBase *> statements;
   while(!check(Token::TokenType::RIGHT_BRACE) && !is_at_end()) {
     statements.push_back(declaration());
   }
@@ -274,33 +284,33 @@ std::vector<std::shared_ptr<stmt::StmtBase>> Parser::block()
   return statements;
 }
 
-std::shared_ptr<stmt::If> Parser::if_statement()
+stmt::If *Parser::if_statement()
 {
   consume(Token::TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
   auto condition = expression();
   consume(Token::TokenType::RIGHT_PAREN, "Expect ')' after condition.");
 
   auto then_stm = statement();
-  std::shared_ptr<stmt::StmtBase> else_stm = nullptr;
+  stmt::StmtBase *else_stm = nullptr;
   if(match(Token::TokenType::ELSE)) {
     else_stm = statement();
   }
-  return std::make_shared<stmt::If>(std::move(condition), std::move(then_stm), std::move(else_stm));
+  return arena.make<stmt::If>(condition, then_stm, else_stm);
 }
 
-std::shared_ptr<stmt::While> Parser::while_statement()
+stmt::While *Parser::while_statement()
 {
   consume(Token::TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
   auto condition = expression();
   consume(Token::TokenType::RIGHT_PAREN, "Expect ')' after condition.");
   auto body = statement();
-  return std::make_shared<stmt::While>(std::move(condition), std::move(body));
+  return arena.make<stmt::While>(condition, body);
 }
 
-std::shared_ptr<stmt::StmtBase> Parser::for_statement()
+stmt::StmtBase *Parser::for_statement()
 {
   consume(Token::TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
-  std::shared_ptr<stmt::StmtBase> initializer;
+  stmt::StmtBase *initializer;
   if(match(Token::TokenType::SEMICOLON)) {
     initializer = nullptr;
   }
@@ -311,13 +321,13 @@ std::shared_ptr<stmt::StmtBase> Parser::for_statement()
     initializer = expr_statement();
   }
   // first ; parsed
-  std::shared_ptr<expr::ExprBase> condition = nullptr;
+  expr::ExprBase *condition = nullptr;
   if(!check(Token::TokenType::SEMICOLON)) {
     condition = expression();
   }
   consume(Token::TokenType::SEMICOLON, "Expect ';' after loop condition.");
 
-  std::shared_ptr<expr::ExprBase> increment = nullptr;
+  expr::ExprBase *increment = nullptr;
   if(!check(Token::TokenType::RIGHT_PAREN)) {
     increment = expression();
   }
@@ -328,26 +338,26 @@ std::shared_ptr<stmt::StmtBase> Parser::for_statement()
   // desugaring the for loop into a while loop
 
   if(increment) {
-    auto statements = std::vector<std::shared_ptr<stmt::StmtBase>>();
-    statements.push_back(std::move(body));
-    statements.push_back(std::make_shared<stmt::Expression>(std::move(increment)));
-    body = std::make_shared<stmt::Block>(std::move(statements));
+    auto statements = std::vector<stmt::StmtBase *>();
+    statements.push_back(body);
+    statements.push_back(arena.make<stmt::Expression>(increment));
+    body = arena.make<stmt::Block>(std::move(statements));
   }
   if(!condition) {
-    condition = std::make_shared<expr::Literal>(Token::Literal{true});
+    condition = arena.make<expr::Literal>(expr::Value(true));
   }
-  body = std::make_shared<stmt::While>(std::move(condition), std::move(body));
+  body = arena.make<stmt::While>(condition, body);
 
   if(initializer) {
-    auto statements = std::vector<std::shared_ptr<stmt::StmtBase>>();
-    statements.push_back(std::move(initializer));
-    statements.push_back(std::move(body));
-    body = std::make_shared<stmt::Block>(std::move(statements));
+    auto statements = std::vector<stmt::StmtBase *>();
+    statements.push_back(initializer);
+    statements.push_back(body);
+    body = arena.make<stmt::Block>(std::move(statements));
   }
   return body;
 }
 
-std::shared_ptr<stmt::Function> Parser::function(std::string kind)
+stmt::Function *Parser::function(std::string kind)
 {
   Token name = consume(Token::TokenType::IDENTIFIER, "Expect " + kind + " name.");
   consume(Token::TokenType::LEFT_PAREN, "Expect '(' after " + kind + " name.");
@@ -363,39 +373,39 @@ std::shared_ptr<stmt::Function> Parser::function(std::string kind)
   consume(Token::TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
   consume(Token::TokenType::LEFT_BRACE, "Expect '{' before " + kind + " body.");
   auto body = block();
-  return std::make_shared<stmt::Function>(name, params, std::move(body));
+  return arena.make<stmt::Function>(name, params, std::move(body), arena);
 }
 
-std::shared_ptr<stmt::Return> Parser::return_statement()
+stmt::Return *Parser::return_statement()
 {
   auto keyword = previous();
-  std::shared_ptr<expr::ExprBase> value = nullptr;
+  expr::ExprBase *value = nullptr;
   if(!check(Token::TokenType::SEMICOLON)) {
     value = expression();
   }
   consume(Token::TokenType::SEMICOLON, "Expect ';' after return value.");
-  return std::make_shared<stmt::Return>(keyword, std::move(value));
+  return arena.make<stmt::Return>(keyword, value);
 }
 
-std::shared_ptr<stmt::Class> Parser::class_declaration()
+stmt::Class *Parser::class_declaration()
 {
   Token name = consume(Token::TokenType::IDENTIFIER, "Expect class name.");
-  std::shared_ptr<expr::Variable> superclass{};
+  expr::Variable *superclass{};
 
   if(match(Token::TokenType::LESS)) {
     consume(Token::TokenType::IDENTIFIER, "Expect superclass name.");
-    superclass = std::make_shared<expr::Variable>(previous());
+    superclass = arena.make<expr::Variable>(previous());
   }
 
   consume(Token::TokenType::LEFT_BRACE, "Expect '{' before class body.");
 
-  std::vector<std::shared_ptr<stmt::Function>> methods;
+  std::vector<stmt::Function *> methods;
   while(!check(Token::TokenType::RIGHT_BRACE) && !is_at_end()) {
     methods.push_back(function("method"));
   }
 
   consume(Token::TokenType::RIGHT_BRACE, "Expect '}' after class body.");
-  return std::make_shared<stmt::Class>(name, std::move(superclass), std::move(methods));
+  return arena.make<stmt::Class>(name, superclass, std::move(methods));
 }
 
 void Parser::synchronize()
@@ -13,9 +13,11 @@ void Resolver::declare(const Token &token)
   auto lexeme = token.get_lexeme();
   if(scope_top.find(lexeme) != scope_top.end()) {
     Lox::error(token, "Already a variable with this name in this scope.");
+    return;
   }
-  // mark the variable as not ready yet
-  scope_top[lexeme] = false;
+  // mark the variable as not ready yet; locals get slots in declaration order
+  int slot = scope_top.size();
+  scope_top.emplace(lexeme, Local{slot, false});
 }
 
 void Resolver::define(const Token &token)
@@ -23,7 +25,7 @@ void Resolver::define(const Token &token)
   if(scopes.empty())
     return;
   // mark the variable as ready
-  scopes.back()[token.get_lexeme()] = true;
+  scopes.back()[token.get_lexeme()].ready = true;
 }
 
 void Resolver::visit_binary_expr(const expr::Binary &expr)
@@ -40,22 +42,23 @@ void Resolver::visit_literal_expr(const expr::Literal &expr) {
 
 void Resolver::visit_unary_expr(const expr::Unary &expr) { resolve(expr.right); };
 
-void Resolver::visit_variable_expr(const std::shared_ptr<const expr::Variable> &expr)
+void Resolver::visit_variable_expr(const expr::Variable &expr)
 {
-  auto &token = expr.get()->token;
+  auto &token = expr.token;
   if(!scopes.empty()) {
     auto &scope_top = scopes.back();
-    if(scope_top.find(token.get_lexeme()) != scope_top.end() && !scope_top[token.get_lexeme()]) {
+    auto it = scope_top.find(token.get_lexeme());
+    if(it != scope_top.end() && !it->second.ready) {
       Lox::error(token, "Can't read local variable in its own initializer.");
     }
   }
   resolve_local(expr, token);
 };
 
-void Resolver::visit_assignment_expr(const std::shared_ptr<const expr::Assignment> &expr)
+void Resolver::visit_assignment_expr(const expr::Assignment &expr)
 {
-  resolve(expr->value);
-  resolve_local(expr, expr->token);
+  resolve(expr.value);
+  resolve_local(expr, expr.token);
 };
 
 void Resolver::visit_logical_expr(const expr::Logical &expr)
@@ -85,26 +88,26 @@ void Resolver::visit_set_expr(const expr::Set &expr)
   resolve(expr.object);
 }
 
-void Resolver::visit_this_expr(const std::shared_ptr<const expr::This> &expr)
+void Resolver::visit_this_expr(const expr::This &expr)
 {
   if(current_class == ClassType::NONE) {
-    Lox::error(expr->token, "Can't use 'this' outside of a class.");
+    Lox::error(expr.token, "Can't use 'this' outside of a class.");
     return;
   }
 
   // treated as a normal variable
-  resolve_local(expr, expr->token);
+  resolve_local(expr, expr.token);
 }
 
-void Resolver::visit_super_expr(const std::shared_ptr<const expr::Super> &expr)
+void Resolver::visit_super_expr(const expr::Super &expr)
 {
   if(current_class == ClassType::NONE) {
-    Lox::error(expr->keyword, "Can't use 'super' outside of a class.");
+    Lox::error(expr.keyword, "Can't use 'super' outside of a class.");
   }
   else if(current_class != ClassType::SUBCLASS) {
-    Lox::error(expr->keyword, "Can't use 'super' in a class with no superclass.");
+    Lox::error(expr.keyword, "Can't use 'super' in a class with no superclass.");
   }
-  resolve_local(expr, expr->keyword);
+  resolve_local(expr, expr.keyword);
 }
 
 void Resolver::visit_print_stmt(const stmt::Print &stmt) { resolve(stmt.ex); };
@@ -145,10 +148,10 @@ void Resolver::visit_while_stmt(const stmt::While &stmt)
   resolve(stmt.body);
 };
 
-void Resolver::visit_fun_stmt(const std::shared_ptr<const stmt::Function> &stmt)
+void Resolver::visit_fun_stmt(const stmt::Function &stmt)
 {
-  declare(stmt->name);
-  define(stmt->name);
+  declare(stmt.name);
+  define(stmt.name);
   // this lets a function recursively refer to itself inside its own body
   resolve_function(stmt, FunctionType::FUNCTION);
 };
@@ -170,70 +173,72 @@ void Resolver::visit_return_stmt(const stmt::Return &stmt)
   }
 };
 
-void Resolver::visit_class_stmt(const std::shared_ptr<const stmt::Class> &stmt)
+void Resolver::visit_class_stmt(const stmt::Class &stmt)
 {
   auto enclosing = current_class;
   current_class = ClassType::CLASS;
 
-  declare(stmt->name);
+  declare(stmt.name);
   // not uncommon to declare a class as a local variable
-  define(stmt->name);
+  define(stmt.name);
 
   // a class can't inherit from itself
-  if(stmt->superclass != nullptr
-     && stmt->name.get_lexeme() == stmt->superclass->token.get_lexeme()) {
-    Lox::error(stmt->superclass->token, "A class can't inherit from itself.");
+  if(stmt.superclass != nullptr
+     && stmt.name.get_lexeme() == stmt.superclass->token.get_lexeme()) {
+    Lox::error(stmt.superclass->token, "A class can't inherit from itself.");
   }
 
   // resolve the superclass
-  if(stmt->superclass != nullptr) {
+  if(stmt.superclass != nullptr) {
     current_class = ClassType::SUBCLASS;
-    resolve(stmt->superclass);
+    resolve(stmt.superclass);
     // if the class decl has a superclass, we create a scope for it sorrouding all of its methods,
     // where we define `super`
     begin_scope();
-    scopes.back()["super"] = true;
+    scopes.back().emplace("super", Local{0, true});
   }
 
   // make `this` visible to the function bodies
   begin_scope();
-  scopes.back()["this"] = true;
+  scopes.back().emplace("this", Local{0, true});
 
   // resolve the methods
-  for(auto &method : stmt->methods) {
+  for(auto &method : stmt.methods) {
     auto func_type
       = method->name.get_lexeme() == "init" ? FunctionType::INITIALIZER : FunctionType::METHOD;
-    resolve_function(method, func_type);
+    resolve_function(*method, func_type);
   }
 
   end_scope(); // `this` is no longer visible
 
-  if(stmt->superclass != nullptr) {
+  if(stmt.superclass != nullptr) {
     end_scope(); // `super` is no longer visible
   }
 
   current_class = enclosing;
 }
 
-void Resolver::resolve(const std::vector<std::shared_ptr<stmt::StmtBase>> &statements)
+void Resolver::resolve(const std::vector<stmt::StmtBase *> &statements)
 {
   for(auto &stm : statements) {
     resolve(stm);
   }
 }
 
-void Resolver::resolve_local(const std::shared_ptr<const expr::ExprBase> &expr, const Token &token)
+void Resolver::resolve_local(const expr::Resolved &expr, const Token &token)
 {
   for(int i = scopes.size() - 1; i >= 0; i--) {
-    if(scopes[i].find(token.get_lexeme()) != scopes[i].end()) {
-      interpreter.resolve(expr, scopes.size() - i - 1);
+    auto it = scopes[i].find(token.get_lexeme());
+    if(it != scopes[i].end()) {
+      expr.depth = scopes.size() - i - 1;
+      expr.slot = it->second.slot;
       return;
     }
   }
+  // not found: assume it is global
 }
 
-void Resolver::resolve_function(const std::shared_ptr<const stmt::Function> &function,
-                                FunctionType type)
+void Resolver::resolve_function(const stmt::Function &function, FunctionType type)
 {
   // used to resolve both functions and methods
 
@@ -241,11 +246,11 @@ void Resolver::resolve_function(const std::shared_ptr<const stmt::Function> &fun
   current_func = type;
 
   begin_scope();
-  for(auto &param : function->params) {
+  for(auto &param : function.params) {
     declare(param);
     define(param);
   }
-  resolve(function->body);
+  resolve(function.body);
   end_scope();
 
   current_func = enclosing_func;
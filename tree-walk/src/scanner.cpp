@@ -1,7 +1,7 @@
 #include <lox.hpp>
 #include <scanner.hpp>
 
-const std::unordered_map<std::string, Token::TokenType> Scanner::keywords{
+const std::unordered_map<std::string_view, Token::TokenType> Scanner::keywords{
   {"and", Token::TokenType::AND},       {"class", Token::TokenType::CLASS},
   {"else", Token::TokenType::ELSE},     {"false", Token::TokenType::FALSE},
   {"for", Token::TokenType::FOR},       {"fun", Token::TokenType::FUN},
@@ -18,8 +18,8 @@ std::vector<Token> Scanner::scan_tokens()
     scan_token();
   }
 
-  tokens.push_back(Token(Token::TokenType::END_OF_FILE, "", "", line));
-  return tokens;
+  tokens.push_back(Token(Token::TokenType::END_OF_FILE, "", line));
+  return std::move(tokens);
 }
 
 void Scanner::scan_token()
@@ -90,7 +90,7 @@ void Scanner::number()
       advance();
     }
   }
-  add_token(Token::TokenType::NUMBER, std::stod(source.substr(start, current - start)));
+  add_token(Token::TokenType::NUMBER);
 }
 
 void Scanner::identifier()
@@ -99,7 +99,7 @@ void Scanner::identifier()
     advance();
   }
 
-  std::string text = source.substr(start, current - start);
+  auto text = source.substr(start, current - start);
   Token::TokenType type{};
 
   if(keywords.find(text) != keywords.end()) {
@@ -123,9 +123,7 @@ void Scanner::string()
     Lox::error(line, "Unterminated string.");
     return;
   }
-  // The closing quote
+  // The closing quote; the parser trims the quotes off the lexeme
   advance();
-  // Trim the surrounding quotes.
-  std::string value = source.substr(start + 1, current - start - 2);
-  add_token(Token::TokenType::STRING, value);
+  add_token(Token::TokenType::STRING);
 }
\ No newline at end of file
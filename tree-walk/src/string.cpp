@@ -0,0 +1,33 @@
+#include <string.hpp>
+
+std::unordered_map<LoxString::Key, LoxString::Data *, LoxString::KeyHash> &LoxString::strings()
+{
+  // Weak: strings remove themselves once their last reference goes away.
+  // Never destroyed, as values can be released after static destructors have run.
+  static auto &strings = *new std::unordered_map<Key, Data *, KeyHash>();
+  return strings;
+}
+
+LoxString::LoxString(std::string_view chars)
+{
+  Key key{chars, std::hash<std::string_view>{}(chars)};
+  auto it = strings().find(key);
+  if(it != strings().end()) {
+    data = it->second;
+    data->refs++;
+    return;
+  }
+  data = new Data{std::string(chars), key.hash, 1};
+  strings().emplace(Key{data->chars, key.hash}, data);
+}
+
+LoxString LoxString::operator+(const LoxString &other) const
+{
+  return LoxString(data->chars + other.data->chars);
+}
+
+void LoxString::release(Data *data)
+{
+  strings().erase(Key{data->chars, data->hash});
+  delete data;
+}
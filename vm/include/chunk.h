@@ -1,6 +1,10 @@
 #pragma once
 #include <value.h>
 
+// forward declaration
+typedef struct obj_closure obj_closure_t;
+typedef struct obj_shape obj_shape_t;
+
 typedef enum {
   OP_CONSTANT,
   OP_NIL,
@@ -9,6 +13,8 @@ typedef enum {
   OP_POP,
   OP_GET_LOCAL,
   OP_SET_LOCAL,
+  OP_SET_LOCAL_POP,
+  OP_INC_LOCAL,
   OP_GET_GLOBAL,
   OP_DEFINE_GLOBAL,
   OP_SET_GLOBAL,
@@ -17,10 +23,15 @@ typedef enum {
   OP_SET_PROPERTY,
   OP_GET_PROPERTY,
   OP_GET_SUPER,
+  OP_GET_PROPERTY_PAIR,
+  OP_GET_SUPER_PAIR,
+  OP_GET_LOCAL_PAIR,
   OP_EQUAL,
   OP_GREATER,
   OP_LESS,
   OP_ADD,
+  OP_ADD_LOCALS,
+  OP_ADD_CONSTANT,
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
@@ -29,27 +40,96 @@ typedef enum {
   OP_PRINT,
   OP_JUMP,
   OP_JUMP_IF_FALSE,
+  OP_LESS_JUMP,
   OP_LOOP,
   OP_CALL,
+  OP_TAIL_CALL,
+  OP_CALL_PAIR,
   OP_INVOKE,
+  OP_TAIL_INVOKE,
   OP_SUPER_INVOKE,
   OP_CLOSURE,
   OP_CLOSE_UPVALUE,
   OP_RETURN,
   OP_CLASS,
   OP_INHERIT,
-  OP_METHOD
+  OP_METHOD,
+  // Register instructions, see registers.c
+  OP_REG_MOVE,
+  OP_REG_LOADK,
+  OP_REG_ADD,
+  OP_REG_ADDK,
+  OP_REG_SUBTRACT,
+  OP_REG_SUBTRACTK,
+  OP_REG_MULTIPLY,
+  OP_REG_MULTIPLYK,
+  OP_REG_DIVIDE,
+  OP_REG_DIVIDEK,
+  OP_REG_EQUAL,
+  OP_REG_EQUALK,
+  OP_REG_GREATER,
+  OP_REG_GREATERK,
+  OP_REG_LESS,
+  OP_REG_LESSK,
+  OP_REG_EQUAL_JUMP,
+  OP_REG_EQUAL_JUMPK,
+  OP_REG_GREATER_JUMP,
+  OP_REG_GREATER_JUMPK,
+  OP_REG_LESS_JUMP,
+  OP_REG_LESS_JUMPK
 } op_code_t;
 
+#define OP_COUNT (OP_REG_LESS_JUMPK + 1)
+
+/* Operands of the register instructions are slots of the frame, either locals or temporaries on the
+stack, except the last one of the K forms which indexes the constant table. Since temporaries may be
+consumed or produced, the first operand is the new depth of the stack in the frame:
+
+  OP_REG_MOVE top dst src
+  OP_REG_LOADK top dst k
+  OP_REG_ADD top dst b c                (and the other arithmetic and comparisons)
+  OP_REG_ADDK top dst b k
+  OP_REG_LESS_JUMP top jump_if b c offset
+  OP_REG_LESS_JUMPK top jump_if b k offset
+
+The compare and jump instructions jump when the comparison equals `jump_if`. Every K form comes
+right after its register form. */
+
+// Number of receiver shapes an inline cache remembers before the call site is considered
+// megamorphic and always takes the generic lookup path.
+#define INLINE_CACHE_ENTRIES 4
+
+typedef struct {
+  obj_shape_t *shape;      // shape of the receiver this entry is valid for
+  obj_closure_t *method;   // the method the name resolved to, NULL if it resolved to a field
+  obj_shape_t *transition; // for OP_SET_PROPERTY adding the field: the shape after the store
+  int slot;                // index of the field in the instance fields array
+} cache_entry_t;
+
+// Every OP_GET_PROPERTY(_PAIR), OP_SET_PROPERTY and OP_INVOKE owns one of these, indexed by its operand.
+typedef struct {
+  int count;
+  bool megamorphic;
+  cache_entry_t entries[INLINE_CACHE_ENTRIES];
+} inline_cache_t;
+
 typedef struct {
   int count;
   int capacity;
   uint8_t *code;
   int *lines;
   value_array_t constants;
+
+  int cache_count;
+  int cache_capacity;
+  inline_cache_t *caches;
 } chunk_t;
 
 void init_chunk(chunk_t *c);
 void free_chunk(chunk_t *c);
 void write_chunk(chunk_t *c, uint8_t byte, int line);
-int add_constant(chunk_t *c, value_t value);
\ No newline at end of file
+int add_constant(chunk_t *c, value_t value);
+int add_inline_cache(chunk_t *c);
+int instruction_length(chunk_t *chunk, int offset);
+bool is_jump(uint8_t opcode);
+int jump_target(chunk_t *chunk, int offset);
\ No newline at end of file
@@ -9,6 +9,25 @@
 //#define DEBUG_TRACE_EXECUTION
 //#define DEBUG_STRESS_GC
 //#define DEBUG_LOG_GC
+//#define DEBUG_INLINE_CACHE
+//#define DEBUG_GC_PAUSES
+//#define DEBUG_OPCODE_PAIRS
 #define NAN_BOXING
 
+// Threaded dispatch in run() needs the labels-as-values extension of GCC and Clang.
+// Comment out to fall back to the portable switch.
+#if defined(__GNUC__)
+#define COMPUTED_GOTO
+#endif
+
+// Small blocks come from size-class pools rather than malloc(). Comment out to have every block
+// checked by tools like AddressSanitizer.
+#define POOL_ALLOCATOR
+
+// Marking on several threads needs POSIX threads and the atomic builtins of GCC and Clang.
+// Comment out to always mark on the main thread.
+#if defined(__GNUC__) && defined(__unix__)
+#define PARALLEL_MARK
+#endif
+
 #define UINT8_COUNT (UINT8_MAX + 1)
\ No newline at end of file
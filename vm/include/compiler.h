@@ -2,4 +2,5 @@
 #include <vm.h>
 
 obj_function_t * compile(const char *source);
+int global_slot(obj_string_t *name);
 void mark_compiler_roots();
\ No newline at end of file
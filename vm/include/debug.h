@@ -3,4 +3,5 @@
 #include <chunk.h>
 
 void disassemble_chunk(chunk_t *chunk, const char *name);
-int disassemble_instruction(chunk_t *chunk, int offset);
\ No newline at end of file
+int disassemble_instruction(chunk_t *chunk, int offset);
+const char *opcode_name(uint8_t opcode);
\ No newline at end of file
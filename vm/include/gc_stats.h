@@ -0,0 +1,60 @@
+#pragma once
+
+#include <common.h>
+#include <object.h>
+#include <stdio.h>
+
+#define GC_PAUSE_BUCKETS 24
+
+typedef enum {
+  GC_MINOR,       // Nursery only
+  GC_MAJOR,       // Whole heap, marked in one go
+  GC_INCREMENTAL, // Whole heap, marked in steps
+} gc_kind_t;
+
+typedef enum { GC_PAUSE_MINOR, GC_PAUSE_MAJOR, GC_PAUSE_STEP, GC_PAUSE_KINDS } gc_pause_t;
+
+// Record of a collection. A major one stays open until its lazy sweep is over, so other
+// collections may be recorded in between.
+typedef struct {
+  gc_kind_t kind;
+  double start; // In us since the VM started
+  size_t bytes_before;
+  size_t bytes_after;
+  size_t freed[OBJ_TYPE_COUNT]; // Objects freed, by type
+  double mark_us;  // Summed over the steps of incremental cycles...
+  double sweep_us; // ...and over the chunks of lazy sweeps
+  size_t next_gc;  // Threshold set at the end
+} gc_cycle_t;
+
+typedef struct {
+  size_t objects[OBJ_TYPE_COUNT];
+  size_t bytes[OBJ_TYPE_COUNT]; // Size of the objects themselves, not of the arrays they own
+} gc_census_t;
+
+typedef struct {
+  int count;
+  int capacity;
+  gc_cycle_t *cycles;
+  int major; // Index of the open major cycle, -1 if none
+  double epoch;
+
+  // Bucket i counts the pauses shorter than 2^i us
+  size_t pauses[GC_PAUSE_KINDS][GC_PAUSE_BUCKETS];
+  double max_pause; // In us
+} gc_stats_t;
+
+double now_us();
+
+// The collector records its work only after enable_gc_stats(); the functions below do nothing
+// and return NULL until then.
+void enable_gc_stats();
+void free_gc_stats();
+gc_cycle_t *gc_cycle_begin(gc_kind_t kind);
+gc_cycle_t *gc_major_cycle();
+void gc_cycle_end(gc_cycle_t *cycle);
+void gc_record_pause(gc_pause_t kind, double start);
+
+void gc_census(gc_census_t *census);
+void print_gc_pauses();
+void print_gc_stats(FILE *out);
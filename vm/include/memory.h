@@ -16,6 +16,31 @@
 void *reallocate(void *pointer, size_t old_size, size_t new_size);
 void free_objects();
 void free_object(obj_t *object);
+size_t object_size(obj_t *object);
 void mark_value(value_t value);
 void mark_object(obj_t *object);
-void collect_garbage();
\ No newline at end of file
+void remember_object(obj_t *object);
+void collect_garbage();
+void collect_nursery();
+#ifdef POOL_ALLOCATOR
+void compact_heap();
+#endif
+
+// Write barrier of the generational collector. It must follow every store of a reference into an
+// object that may be old: an old object pointing to a young one is remembered, so that the next
+// minor collection traces it like a root. During an incremental major cycle the same check
+// re-grays a marked object that gets a white one stored into it (an incremental-update barrier).
+static inline void write_barrier_object(obj_t *object)
+{
+  // Unchecked version, for stores of many references at once (e.g. into a table)
+  if(object->is_marked && !object->is_remembered) {
+    remember_object(object);
+  }
+}
+
+static inline void write_barrier(obj_t *object, value_t value)
+{
+  if(IS_OBJ(value) && !AS_OBJ(value)->is_marked) {
+    write_barrier_object(object);
+  }
+}
\ No newline at end of file
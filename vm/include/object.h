@@ -13,6 +13,7 @@
 #define IS_CLOSURE(value) is_obj_type(value, OBJ_CLOSURE)
 #define IS_CLASS(value) is_obj_type(value, OBJ_CLASS)
 #define IS_BOUND_METHOD(value) is_obj_type(value, OBJ_BOUND_METHOD)
+#define IS_SHAPE(value) is_obj_type(value, OBJ_SHAPE)
 
 #define AS_STRING(value) ((obj_string_t *)AS_OBJ(value))
 #define AS_CSTRING(value) (((obj_string_t *)AS_OBJ(value))->chars)
@@ -22,6 +23,7 @@
 #define AS_CLOSURE(value) ((obj_closure_t *)AS_OBJ(value))
 #define AS_CLASS(value) ((obj_class_t *)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((obj_bound_method_t *)AS_OBJ(value))
+#define AS_SHAPE(value) ((obj_shape_t *)AS_OBJ(value))
 
 typedef enum {
   OBJ_BOUND_METHOD,
@@ -30,13 +32,20 @@ typedef enum {
   OBJ_FUNCTION,
   OBJ_INSTANCE,
   OBJ_NATIVE,
+  OBJ_SHAPE,
   OBJ_STRING,
   OBJ_UPVALUE
 } obj_type_t;
 
+#define OBJ_TYPE_COUNT (OBJ_UPVALUE + 1)
+
 struct obj {
   obj_type_t type;
-  bool is_marked; // for GC
+  // for GC. The bit is sticky: between collections it is set exactly on the old objects, the ones
+  // that survived a collection (see memory.c)
+  bool is_marked;
+  bool is_remembered; // old object in the remembered set
+  bool is_forwarded;  // moved by a compaction, which left the address of the copy in next
   struct obj *next;
 };
 
@@ -75,23 +84,47 @@ typedef struct obj_upvalue {
 
 // Closures are basically functions, but capture the sorroundings locals through upvalues.
 // The number of upvalues is tracked by the function object.
-typedef struct {
+struct obj_closure {
   obj_t base;
   obj_function_t *function;
   obj_upvalue_t **upvalues;
   int upvalue_count;
-} obj_closure_t;
+};
+
+// A shape describes the layout of the fields of an instance: which fields it has and at which slot
+// of the fields array each one is stored. Shapes form a transition tree rooted at the class: adding
+// a field moves the instance to the child shape for that name, so instances that set the same
+// fields in the same order share the same shape.
+struct obj_shape {
+  obj_t base;
+  struct obj_shape *parent;
+  obj_string_t *name;     // the field added by the transition from parent, NULL for the root
+  int field_count;        // number of fields of the instances with this shape
+  table_t *slots;         // field name -> slot, possibly shared with descendants (see shape.c)
+  bool owns_slots;
+  table_t transitions;    // field name -> child shape
+};
+
+// Most inline fields an instance gets, more spill to a separate array. It keeps a single instance
+// with many fields from making every later instance of its class that large.
+#define INLINE_FIELDS_MAX 16
 
 typedef struct {
   obj_t base;
   obj_string_t *name;
   table_t methods;
+  obj_shape_t *shape;     // root of the shape tree, the shape of a brand new instance
+  int field_count;        // most fields an instance had so far, up to INLINE_FIELDS_MAX
 } obj_class_t;
 
 typedef struct {
   obj_t base;
   obj_class_t *klass;
-  table_t fields;
+  obj_shape_t *shape;
+  value_t *fields;        // points to inline_fields until the instance outgrows them
+  int capacity;           // number of slots in fields
+  int inline_count;
+  value_t inline_fields[]; // flexible array
 } obj_instance_t;
 
 typedef struct {
@@ -108,6 +141,7 @@ static inline bool is_obj_type(value_t value, obj_type_t type)
 obj_bound_method_t *new_bound_method(value_t receiver, obj_closure_t *method);
 obj_instance_t *new_instance(obj_class_t *klass);
 obj_class_t *new_class(obj_string_t *name);
+obj_shape_t *new_shape(obj_shape_t *parent, obj_string_t *name);
 obj_native_t *new_native(native_fn_t function);
 obj_upvalue_t *new_upvalue(value_t *location);
 obj_closure_t *new_closure(obj_function_t *function);
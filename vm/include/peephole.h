@@ -0,0 +1,5 @@
+#pragma once
+
+#include <chunk.h>
+
+void optimize_chunk(chunk_t *chunk);
\ No newline at end of file
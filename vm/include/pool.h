@@ -0,0 +1,23 @@
+#pragma once
+
+#include <common.h>
+
+// Blocks up to POOL_MAX_SIZE bytes are carved out of pages holding blocks of a single size class,
+// rounded up to a multiple of POOL_GRANULE. Larger ones come from malloc().
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 256
+#define POOL_PAGE_SIZE (64 * 1024)
+
+#define POOL_CLASS(size) (((size) + POOL_GRANULE - 1) / POOL_GRANULE - 1)
+
+void *pool_alloc(size_t size);
+void pool_free(void *pointer, size_t size);
+void pool_release_empty_pages();
+void free_pools();
+
+// Compaction: blocks in the pages picked by pool_begin_evacuation() are moved elsewhere by the
+// caller, with pool_alloc() and pool_free(), and the emptied pages are released at the end.
+double pool_fragmentation();
+void pool_begin_evacuation();
+bool pool_is_evacuating(void *block);
+void pool_end_evacuation();
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <object.h>
+
+void translate_registers(obj_function_t *function);
\ No newline at end of file
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <object.h>
+#include <value.h>
+
+obj_shape_t *shape_transition(obj_shape_t *shape, obj_string_t *name);
+int shape_find_slot(obj_shape_t *shape, obj_string_t *name);
+int instance_set_field(obj_instance_t *instance, obj_string_t *name, value_t value);
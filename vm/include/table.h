@@ -9,7 +9,8 @@ typedef struct {
 } entry_t;
 
 typedef struct {
-  int count;
+  int count;      // entries in use, tombstones included
+  int tombstones; // deleted entries, which still lengthen the probe sequences
   int capacity;
   entry_t *entries;
 } table_t;
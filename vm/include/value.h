@@ -74,6 +74,10 @@ typedef struct {
 #define OBJ_VAL(o) ((value_t){VAL_OBJ, {.obj = (obj_t *)o}})
 #endif
 
+// No Lox value is a null object, so this can mark a variable that has not been defined yet
+#define UNDEFINED_VAL OBJ_VAL(NULL)
+#define IS_UNDEFINED(value) (IS_OBJ(value) && AS_OBJ(value) == NULL)
+
 typedef struct {
   int capacity;
   int count;
@@ -81,6 +85,13 @@ typedef struct {
 } value_array_t;
 
 bool values_equal(value_t left, value_t right);
+
+// Shared by the VM and the constant folding of the compiler
+static inline bool is_falsey(value_t value)
+{
+  return IS_NIL(value) || (IS_BOOL(value) && AS_BOOL(value) == false);
+}
+
 void init_value_array(value_array_t *array);
 void free_value_array(value_array_t *array);
 void write_value_array(value_array_t *array, value_t value);
@@ -1,12 +1,20 @@
 #pragma once
 
 #include <chunk.h>
+#include <gc_stats.h>
 #include <object.h>
 #include <table.h>
 #include <value.h>
 
-#define FAMES_MAX 64
-#define STACK_MAX (FAMES_MAX * UINT8_COUNT)
+// The frames and the value stack start small and grow on demand, up to FAMES_MAX nested calls
+#define FAMES_MAX (64 * 1024)
+#define FRAMES_INITIAL 16
+#define STACK_INITIAL (2 * UINT8_COUNT)
+#define GC_STEP_OBJECTS 256 // Default budget of an incremental marking step
+#define GC_INITIAL_HEAP (1024 * 1024) // Default threshold of the first major collection
+#define GC_HEAP_GROWTH_FACTOR 2       // Default growth of the heap between major collections
+#define GC_SOFT_GROWTH_FACTOR 1.25    // Growth past the soft limit
+#define GC_MAX_THREADS 64
 
 // This represents a single ongoing function call. It is created each time a function is called.
 // The slots field points into the VM's value stack at the first slot usable by this function.
@@ -16,24 +24,86 @@ typedef struct {
   value_t *slots;
 } callframe_t;
 
+// Phase of an incremental major collection
+typedef enum {
+  GC_IDLE,     // No major collection is in progress
+  GC_CLEARING, // Resetting the sticky marks of the old objects
+  GC_MARKING,  // Tracing the heap from the roots
+  GC_SWEEPING, // Freeing the white objects, a chunk at each allocation
+} gc_phase_t;
+
 typedef struct {
-  callframe_t frames[FAMES_MAX];
-  int frame_count; // number of ongoing function calls
+  callframe_t *frames; // Owned by the VM
+  int frame_count;      // number of ongoing function calls
+  int frame_capacity;
 
-  value_t stack[STACK_MAX];
+  /* Owned by the VM. Growing the stack moves it, so a pointer into it must not be held across a
+  push() or a call: the frame slots, stack_top and the locations of the open upvalues are fixed up,
+  nothing else is. */
+  value_t *stack;
   value_t *stack_top;
-  table_t globals;
+  value_t *stack_end;
+  // Globals are accessed by the slot the compiler assigned to their name. A slot holds
+  // UNDEFINED_VAL until the global is defined.
+  table_t global_slots;        // name -> slot, kept across compilations (e.g. REPL lines)
+  value_array_t global_names;  // name of each slot, for error messages
+  value_array_t global_values;
   table_t strings; // string interning
   obj_string_t *init_string;
-  obj_t *objects;
+  obj_t *objects;       // Old generation: objects that survived a collection
+  obj_t *young_objects; // Nursery: objects allocated since the last collection
+  obj_t *young_tail;    // Oldest object of the nursery, to splice it onto the old list
   obj_upvalue_t *open_upvalues;
 
   int gray_count;
   int gray_capacity;
   obj_t **gray_stack; // Owned by the VM
 
+  // Old objects that may point to young ones, recorded by the write barrier
+  int remembered_count;
+  int remembered_capacity;
+  obj_t **remembered; // Owned by the VM
+
   size_t bytes_allocated; // Total memory used by the VM
   size_t next_gc; // Threshold for next GC
+  // Heap sizing, see next_threshold() in memory.c
+  double gc_growth;      // The next threshold is the surviving heap times this...
+  size_t gc_min_heap;    // ...but never less than this
+  size_t gc_soft_limit;  // Past this the heap only grows by GC_SOFT_GROWTH_FACTOR, 0 for no limit
+  size_t gc_max_heap;    // Past this the program runs out of memory, 0 for no limit
+  bool heap_exhausted;   // Set past gc_max_heap, run() raises the error at its next safe point
+  size_t nursery_bytes; // Allocated since the last collection, triggers minor collections
+
+  // In incremental mode a major collection is spread over many steps, one per allocation, instead
+  // of stopping the program until the whole heap is traced.
+  bool gc_incremental;
+  int gc_step_objects; // Budget of a step, in objects...
+  double gc_step_us;   // ...or in microseconds, when positive
+  gc_phase_t gc_phase;
+  int gc_threads; // Threads tracing the heap in a major collection
+  double gc_compact; // Share of free pool blocks past which the heap is compacted, 0 for never
+  bool compact_pending; // Set by the sweep, run() compacts at its next safe point
+  obj_t *gc_cursor; // Next old object whose mark is reset by the clearing phase
+  obj_t **gc_sweep; // Link to the next old object looked at by the sweeping phase
+
+  // Collector telemetry, NULL unless enabled (--gc-stats). Major pauses are full collections, or
+  // the last step of incremental ones.
+  gc_stats_t *gc_stats;
+  bool gc_stats_dump; // Print the stats as JSON when the VM is freed
+
+  bool register_backend; // Compile to register instructions (--registers), see registers.c
+
+#ifdef DEBUG_INLINE_CACHE
+  // Inline cache statistics, printed by free_vm()
+  size_t cache_hits;
+  size_t cache_misses;
+  size_t cache_megamorphic; // Lookups done by call sites that gave up caching
+#endif
+#ifdef DEBUG_OPCODE_PAIRS
+  // How many times each opcode ran right after another one, printed by free_vm()
+  size_t opcode_pairs[OP_COUNT][OP_COUNT];
+  int last_opcode; // -1 before the first instruction
+#endif
 
 } vm_t;
 
@@ -1,5 +1,6 @@
 #include <chunk.h>
 #include <memory.h>
+#include <object.h>
 #include <vm.h>
 
 void init_chunk(chunk_t *chunk)
@@ -9,6 +10,9 @@ void init_chunk(chunk_t *chunk)
   chunk->code = NULL;
   chunk->lines = NULL;
   init_value_array(&chunk->constants);
+  chunk->cache_count = 0;
+  chunk->cache_capacity = 0;
+  chunk->caches = NULL;
 }
 
 void free_chunk(chunk_t *c)
@@ -16,6 +20,7 @@ void free_chunk(chunk_t *c)
   FREE_ARRAY(uint8_t, c->code, c->capacity);
   FREE_ARRAY(int, c->lines, c->capacity);
   free_value_array(&c->constants);
+  FREE_ARRAY(inline_cache_t, c->caches, c->cache_capacity);
   init_chunk(c);
 }
 
@@ -43,4 +48,123 @@ int add_constant(chunk_t *c, value_t value)
   write_value_array(&c->constants, value);
   pop();
   return c->constants.count - 1; // return the index of the constant
+}
+
+int add_inline_cache(chunk_t *c)
+{
+  if(c->cache_capacity < c->cache_count + 1) {
+    int old_cap = c->cache_capacity;
+    c->cache_capacity = GROW_CAPACITY(old_cap);
+    c->caches = GROW_ARRAY(inline_cache_t, c->caches, old_cap, c->cache_capacity);
+  }
+  // A new cache is empty: the first execution of the instruction will fill it
+  inline_cache_t *cache = &c->caches[c->cache_count];
+  cache->count = 0;
+  cache->megamorphic = false;
+  return c->cache_count++; // return the index of the cache
+}
+
+int instruction_length(chunk_t *chunk, int offset)
+{
+  switch(chunk->code[offset]) {
+  case OP_CONSTANT:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_POP:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+  case OP_GET_SUPER:
+  case OP_GET_SUPER_PAIR:
+  case OP_GET_LOCAL_PAIR:
+  case OP_ADD_CONSTANT:
+  case OP_CALL:
+  case OP_TAIL_CALL:
+  case OP_CLASS:
+  case OP_METHOD:
+    return 2;
+
+  case OP_GET_GLOBAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_INC_LOCAL:
+  case OP_ADD_LOCALS:
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+  case OP_CALL_PAIR:
+  case OP_SUPER_INVOKE:
+    return 3;
+
+  case OP_SET_PROPERTY:
+  case OP_GET_PROPERTY:
+  case OP_GET_PROPERTY_PAIR:
+    return 4;
+
+  case OP_REG_MOVE:
+  case OP_REG_LOADK:
+    return 4;
+
+  case OP_LESS_JUMP:
+  case OP_INVOKE:
+  case OP_TAIL_INVOKE:
+  case OP_REG_ADD:
+  case OP_REG_ADDK:
+  case OP_REG_SUBTRACT:
+  case OP_REG_SUBTRACTK:
+  case OP_REG_MULTIPLY:
+  case OP_REG_MULTIPLYK:
+  case OP_REG_DIVIDE:
+  case OP_REG_DIVIDEK:
+  case OP_REG_EQUAL:
+  case OP_REG_EQUALK:
+  case OP_REG_GREATER:
+  case OP_REG_GREATERK:
+  case OP_REG_LESS:
+  case OP_REG_LESSK:
+    return 5;
+
+  case OP_REG_EQUAL_JUMP:
+  case OP_REG_EQUAL_JUMPK:
+  case OP_REG_GREATER_JUMP:
+  case OP_REG_GREATER_JUMPK:
+  case OP_REG_LESS_JUMP:
+  case OP_REG_LESS_JUMPK:
+    return 7;
+
+  case OP_CLOSURE: {
+    // Followed by a pair of bytes for each upvalue
+    obj_function_t *function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+    return 2 + 2 * function->upvalue_count;
+  }
+
+  default:
+    return 1;
+  }
+}
+
+bool is_jump(uint8_t opcode)
+{
+  switch(opcode) {
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+  case OP_LESS_JUMP:
+  case OP_REG_EQUAL_JUMP:
+  case OP_REG_EQUAL_JUMPK:
+  case OP_REG_GREATER_JUMP:
+  case OP_REG_GREATER_JUMPK:
+  case OP_REG_LESS_JUMP:
+  case OP_REG_LESS_JUMPK:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Offset of the instruction a jump at `offset` goes to. The distance is always in the last two bytes.
+int jump_target(chunk_t *chunk, int offset)
+{
+  int after = offset + instruction_length(chunk, offset);
+  uint16_t jump = (chunk->code[after - 2] << 8) | chunk->code[after - 1];
+  return chunk->code[offset] == OP_LOOP ? after - jump : after + jump;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include <compiler.h>
 #include <memory.h>
 #include <object.h>
+#include <peephole.h>
+#include <registers.h>
 #include <scanner.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,6 +46,7 @@ typedef struct {
   token_t name;     // used to compare the current identifier to the name of the variable
   int depth;        // records the scope where the variable was declared
   bool is_captured; // true if the variable is captured by a later nested function (closure)
+  bool is_pair;     // true if the variable holds a receiver and, in the next slot, its method
 } local_t;
 
 // Upvalues refer to local variables in an enclosing function
@@ -75,6 +78,13 @@ typedef struct compiler_t {
   int local_count; // tracks how many locals are in scope, i.e. how many array elements are in use
   int scope_depth; // number of blocks sorrounding the current bit of code, zero indicates global
                    // scope
+  int last_get;     // offset of the last OP_GET_PROPERTY or OP_GET_SUPER, -1 if none
+  int last_get_end; // offset right after it
+  int last_target;  // offset the last forward jump lands on, -1 if none
+  int constant_start; // offset of the last instruction loading a constant, see fold_binary()
+  int constant_end;   // offset right after it
+  int last_call;      // offset of the last OP_CALL or OP_INVOKE, -1 if none
+  int last_call_end;  // offset right after it
 } compiler_t;
 
 typedef struct class_compiler {
@@ -217,13 +227,152 @@ static uint8_t make_constant(value_t value)
 {
   // The constant may be heap-allocated
   int constant = add_constant(current_chunk(), value);
+  write_barrier(&g_current_compiler->function->base, value);
   if(constant > UINT8_MAX) {
     error("Too many constants in one chunk.");
     return 0;
   }
   return (uint8_t)constant;
 }
-static void emit_constant(value_t value) { emit_bytes(OP_CONSTANT, make_constant(value)); }
+
+static void emit_constant(value_t value)
+{
+  int start = current_chunk()->count;
+  if(IS_NIL(value)) {
+    emit_byte(OP_NIL);
+  }
+  else if(IS_BOOL(value)) {
+    emit_byte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  }
+  else {
+    emit_bytes(OP_CONSTANT, make_constant(value));
+  }
+  g_current_compiler->constant_start = start;
+  g_current_compiler->constant_end = current_chunk()->count;
+}
+
+/*
+Constant folding. Operators are compiled after their operands, so by then the operands are already
+in the chunk: if each one is a single constant load, the operator is computed right away and the
+loads are replaced by the load of the result. Folding nests, since the result is a constant load
+too: `-1 + 2 * 3` ends up as a single OP_CONSTANT.
+The result is computed the same way the VM would, so folding never changes what a program prints.
+Operations that would fail at runtime, like `-"a"`, are left alone for the VM to report. */
+
+// Tells if the code emitted since `start` is a single constant load, and which constant it loads.
+// A jump landing at the end means that the value may come from elsewhere (as in `a or 1`).
+static bool constant_since(int start, value_t *value)
+{
+  compiler_t *compiler = g_current_compiler;
+  chunk_t *chunk = current_chunk();
+  if(compiler->constant_start != start || compiler->constant_end != chunk->count
+     || compiler->last_target == chunk->count) {
+    return false;
+  }
+  switch(chunk->code[start]) {
+  case OP_CONSTANT: *value = chunk->constants.values[chunk->code[start + 1]]; return true;
+  case OP_NIL: *value = NIL_VAL; return true;
+  case OP_TRUE: *value = BOOL_VAL(true); return true;
+  case OP_FALSE: *value = BOOL_VAL(false); return true;
+  default: return false; // unreachable
+  }
+}
+
+// Replaces the constant loads emitted since `start` with the load of `value`
+static void replace_constants(int start, value_t value)
+{
+  chunk_t *chunk = current_chunk();
+  // Constants are never shared, so those of the loads are the last ones in the array
+  int first = chunk->constants.count;
+  for(int offset = start; offset < chunk->count; offset++) {
+    if(chunk->code[offset] == OP_CONSTANT) {
+      offset++;
+      if(chunk->code[offset] < first) {
+        first = chunk->code[offset];
+      }
+    }
+  }
+  // The value must stay reachable until it is back in the array
+  push(value);
+  chunk->constants.count = first;
+  chunk->count = start;
+  pop();
+  emit_constant(value);
+}
+
+static bool fold_unary(token_type_t operator_type, value_t operand, value_t *result)
+{
+  switch(operator_type) {
+  case TOKEN_MINUS:
+    if(!IS_NUMBER(operand)) {
+      return false;
+    }
+    *result = NUMBER_VAL(-AS_NUMBER(operand));
+    return true;
+  case TOKEN_BANG: *result = BOOL_VAL(is_falsey(operand)); return true;
+  default: return false; // unreachable
+  }
+}
+
+static bool fold_binary(token_type_t operator_type, value_t left, value_t right, value_t *result)
+{
+  // Equality works on any value, and strings are interned
+  if(operator_type == TOKEN_EQUAL_EQUAL || operator_type == TOKEN_BANG_EQUAL) {
+    bool equal = values_equal(left, right);
+    *result = BOOL_VAL(operator_type == TOKEN_EQUAL_EQUAL ? equal : !equal);
+    return true;
+  }
+
+  if(operator_type == TOKEN_PLUS && IS_STRING(left) && IS_STRING(right)) {
+    // Both operands are still in the constants array, so they survive a collection here
+    obj_string_t *a = AS_STRING(left);
+    obj_string_t *b = AS_STRING(right);
+    int length = a->length + b->length;
+    char *chars = ALLOCATE(char, length + 1);
+    memcpy(chars, a->chars, a->length);
+    memcpy(&chars[a->length], b->chars, b->length);
+    chars[length] = '\0';
+    *result = OBJ_VAL(copy_string(chars, length));
+    FREE_ARRAY(char, chars, length + 1);
+    return true;
+  }
+
+  if(!IS_NUMBER(left) || !IS_NUMBER(right)) {
+    return false;
+  }
+  double a = AS_NUMBER(left);
+  double b = AS_NUMBER(right);
+  // `>=` and `<=` compile to the negation of `<` and `>`, which is not the same thing for NaN
+  switch(operator_type) {
+  case TOKEN_GREATER: *result = BOOL_VAL(a > b); break;
+  case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(a < b)); break;
+  case TOKEN_LESS: *result = BOOL_VAL(a < b); break;
+  case TOKEN_LESS_EQUAL: *result = BOOL_VAL(!(a > b)); break;
+  case TOKEN_PLUS: *result = NUMBER_VAL(a + b); break;
+  case TOKEN_MINUS: *result = NUMBER_VAL(a - b); break;
+  case TOKEN_STAR: *result = NUMBER_VAL(a * b); break;
+  case TOKEN_SLASH: *result = NUMBER_VAL(a / b); break;
+  default: return false; // unreachable
+  }
+  return true;
+}
+
+static void emit_short(uint16_t value)
+{
+  // Big endian
+  emit_byte((value >> 8) & 0xFFU);
+  emit_byte(value & 0xFFU);
+}
+
+static void emit_inline_cache()
+{
+  // Property accesses and invocations carry the index of their inline cache as a 16 bit operand
+  int cache = add_inline_cache(current_chunk());
+  if(cache > UINT16_MAX) {
+    error("Too many property accesses in one chunk.");
+  }
+  emit_short((uint16_t)cache);
+}
 
 static void patch_jump(int offset)
 {
@@ -235,6 +384,7 @@ static void patch_jump(int offset)
   // Big endian
   current_chunk()->code[offset] = (jump >> 8) & 0xFFU;
   current_chunk()->code[offset + 1] = jump & 0xFFU;
+  g_current_compiler->last_target = current_chunk()->count;
 }
 
 static void init_compiler(compiler_t *compiler, function_type_t type)
@@ -244,17 +394,26 @@ static void init_compiler(compiler_t *compiler, function_type_t type)
   compiler->type = type;
   compiler->local_count = 0;
   compiler->scope_depth = 0;
+  compiler->last_get = -1;
+  compiler->last_get_end = -1;
+  compiler->last_target = -1;
+  compiler->constant_start = -1;
+  compiler->constant_end = -1;
+  compiler->last_call = -1;
+  compiler->last_call_end = -1;
   compiler->function = new_function();
   g_current_compiler = compiler;
 
   if(type != TYPE_SCRIPT) {
     // Previous token is the function's name
     compiler->function->name = copy_string(g_parser.previous.start, g_parser.previous.length);
+    write_barrier(&compiler->function->base, OBJ_VAL(compiler->function->name));
   }
 
   local_t *local = &compiler->locals[compiler->local_count++];
   local->depth = 0;
   local->is_captured = false;
+  local->is_pair = false;
   if(type == TYPE_METHOD || type == TYPE_INITIALIZER) {
     // For methods, stack slot 0 is reserved for `this`
     local->name.start = "this";
@@ -273,10 +432,46 @@ static uint8_t identifier_constant(token_t *token)
   return make_constant(OBJ_VAL(copy_string(token->start, token->length)));
 }
 
+int global_slot(obj_string_t *name)
+{
+  /* Globals are not looked up by name at runtime: the first time a name is compiled it gets the
+  next slot of the VM globals array and keeps it for the lifetime of the VM, so that code compiled
+  earlier (e.g. by a previous REPL line) still refers to the same variable. The slot stays
+  undefined until an OP_DEFINE_GLOBAL runs. */
+  value_t slot;
+  if(table_get(&g_vm.global_slots, name, &slot)) {
+    return (int)AS_NUMBER(slot);
+  }
+
+  // The arrays can trigger a GC
+  push(OBJ_VAL(name));
+  write_value_array(&g_vm.global_names, OBJ_VAL(name));
+  write_value_array(&g_vm.global_values, UNDEFINED_VAL);
+  table_set(&g_vm.global_slots, name, NUMBER_VAL(g_vm.global_values.count - 1));
+  pop();
+  return g_vm.global_values.count - 1;
+}
+
+static uint16_t global_variable(token_t *name)
+{
+  int slot = global_slot(copy_string(name->start, name->length));
+  if(slot > UINT16_MAX) {
+    error("Too many global variables.");
+    return 0;
+  }
+  return (uint16_t)slot;
+}
+
 static obj_function_t *end_compiler()
 {
   emit_return();
   obj_function_t *function = g_current_compiler->function;
+  if(!g_parser.had_error) {
+    if(g_vm.register_backend) {
+      translate_registers(function);
+    }
+    optimize_chunk(current_chunk());
+  }
 
 #ifdef DEBUG_PRINT_CODE
   if(!g_parser.had_error) {
@@ -341,8 +536,22 @@ static void binary(bool can_assign)
 {
   uint8_t operator_type = g_parser.previous.type;
   parse_rule_t *rule = get_rule(operator_type);
+
+  // The left operand has already been compiled
+  int right_start = current_chunk()->count;
+  value_t left;
+  int left_start = g_current_compiler->constant_start;
+  bool left_constant = constant_since(left_start, &left);
+
   parse_precedence((precedence_t)(rule->precedence + 1));
 
+  value_t right, result;
+  if(left_constant && constant_since(right_start, &right)
+     && fold_binary(operator_type, left, right, &result)) {
+    replace_constants(left_start, result);
+    return;
+  }
+
   switch(operator_type) {
   case TOKEN_EQUAL_EQUAL: emit_byte(OP_EQUAL); break;
   case TOKEN_BANG_EQUAL: emit_bytes(OP_EQUAL, OP_NOT); break;
@@ -378,7 +587,9 @@ static uint8_t argument_list()
 static void call(bool can_assign)
 {
   uint8_t arg_count = argument_list();
+  g_current_compiler->last_call = current_chunk()->count;
   emit_bytes(OP_CALL, arg_count);
+  g_current_compiler->last_call_end = current_chunk()->count;
 }
 
 static void dot(bool can_assign)
@@ -389,16 +600,23 @@ static void dot(bool can_assign)
   if(can_assign && match(TOKEN_EQUAL)) {
     expression();
     emit_bytes(OP_SET_PROPERTY, name);
+    emit_inline_cache();
   }
   else if(match(TOKEN_LEFT_PAREN)) {
     // This is an optimization for method calls. It's pointless to emit OP_GET_PROPERTY followed by
     // OP_CALL.
     uint8_t arg_count = argument_list();
+    g_current_compiler->last_call = current_chunk()->count;
     emit_bytes(OP_INVOKE, name);
     emit_byte(arg_count);
+    emit_inline_cache();
+    g_current_compiler->last_call_end = current_chunk()->count;
   }
   else {
+    g_current_compiler->last_get = current_chunk()->count;
     emit_bytes(OP_GET_PROPERTY, name);
+    emit_inline_cache();
+    g_current_compiler->last_get_end = current_chunk()->count;
   }
 }
 
@@ -508,6 +726,7 @@ static void add_local(token_t name)
   local->name = name;
   local->depth = -1; // this means that the variable has not been initialized
   local->is_captured = false;
+  local->is_pair = false;
 }
 
 static void declare_variable()
@@ -544,7 +763,7 @@ static void declare_variable()
   add_local(*name);
 }
 
-static uint8_t parse_variable(const char *error_message)
+static uint16_t parse_variable(const char *error_message)
 {
   consume(TOKEN_IDENTIFIER, error_message);
   declare_variable();
@@ -552,8 +771,8 @@ static uint8_t parse_variable(const char *error_message)
     // Dummy index for locals
     return 0;
   }
-  // Only globals are looked up by name in the constant table
-  return identifier_constant(&g_parser.previous);
+  // Only globals need a slot in the VM globals array
+  return global_variable(&g_parser.previous);
 }
 
 static void mark_initialized()
@@ -566,7 +785,7 @@ static void mark_initialized()
     = g_current_compiler->scope_depth;
 }
 
-static void define_variable(uint8_t global)
+static void define_variable(uint16_t global)
 {
   // Skip local variables, its value sits on top of the stack and that slot becomes the local
   if(g_current_compiler->scope_depth > 0) {
@@ -574,7 +793,33 @@ static void define_variable(uint8_t global)
     mark_initialized();
     return;
   }
-  emit_bytes(OP_DEFINE_GLOBAL, global);
+  emit_byte(OP_DEFINE_GLOBAL);
+  emit_short(global);
+}
+
+static void pair_variable(uint8_t slot, bool can_assign)
+{
+  /*
+  The local holds a receiver and the method read from it, see var_declaration(). Calling it
+  calls the method with the receiver as `this`, without any bound method. Any other read means
+  that the method escapes, so the VM binds it there and then. */
+  if(can_assign && match(TOKEN_EQUAL)) {
+    expression();
+    emit_bytes(OP_SET_LOCAL, slot);
+    // From now on the local holds a plain value
+    emit_byte(OP_NIL);
+    emit_bytes(OP_SET_LOCAL, slot + 1);
+    emit_byte(OP_POP);
+  }
+  else if(match(TOKEN_LEFT_PAREN)) {
+    emit_bytes(OP_GET_LOCAL, slot);
+    uint8_t arg_count = argument_list();
+    emit_bytes(OP_CALL_PAIR, arg_count);
+    emit_byte(slot + 1);
+  }
+  else {
+    emit_bytes(OP_GET_LOCAL_PAIR, slot);
+  }
 }
 
 static void named_variable(token_t token, bool can_assign)
@@ -582,6 +827,10 @@ static void named_variable(token_t token, bool can_assign)
   // Check if the variable is a local or a global
   uint8_t get_op, set_op;
   int arg = resolve_local(g_current_compiler, &token);
+  if(arg != -1 && g_current_compiler->locals[arg].is_pair) {
+    pair_variable((uint8_t)arg, can_assign);
+    return;
+  }
   if(arg != -1) {
     // Found local
     get_op = OP_GET_LOCAL;
@@ -594,18 +843,24 @@ static void named_variable(token_t token, bool can_assign)
   }
   else {
     // It must be a global
-    arg = identifier_constant(&token);
+    arg = global_variable(&token);
     get_op = OP_GET_GLOBAL;
     set_op = OP_SET_GLOBAL;
   }
 
   // Check if the variable is assigned
+  uint8_t op = get_op;
   if(can_assign && match(TOKEN_EQUAL)) {
     expression();
-    emit_bytes(set_op, (uint8_t)arg);
+    op = set_op;
+  }
+  emit_byte(op);
+  if(op == OP_GET_GLOBAL || op == OP_SET_GLOBAL) {
+    // There can be more than 256 globals
+    emit_short((uint16_t)arg);
   }
   else {
-    emit_bytes(get_op, (uint8_t)arg);
+    emit_byte((uint8_t)arg);
   }
 }
 
@@ -646,7 +901,9 @@ static void super_(bool can_assign)
   }
   else {
     named_variable(synthetic_token("super"), false);
+    g_current_compiler->last_get = current_chunk()->count;
     emit_bytes(OP_GET_SUPER, name);
+    g_current_compiler->last_get_end = current_chunk()->count;
   }
 }
 
@@ -664,17 +921,47 @@ static void this_(bool can_assign)
   variable(false);
 }
 
+static bool pair_initializer()
+{
+  /*
+  A local initialized with a property or super access, like
+
+    var m = obj.method;
+
+  most of the time is only called afterwards. Rather than a bound method, the initializer then
+  leaves the receiver in the local's slot and the method in a hidden local right after it, see
+  pair_variable(). This only works if the access is what the whole initializer evaluates to, i.e.
+  it is the last instruction and no jump skips it (`a or b.c`). */
+  compiler_t *compiler = g_current_compiler;
+  chunk_t *chunk = current_chunk();
+  if(compiler->scope_depth == 0 || compiler->local_count == UINT8_COUNT
+     || compiler->last_get == -1 || compiler->last_get_end != chunk->count
+     || compiler->last_target == chunk->count) {
+    return false;
+  }
+  uint8_t *op = &chunk->code[compiler->last_get];
+  *op = *op == OP_GET_PROPERTY ? OP_GET_PROPERTY_PAIR : OP_GET_SUPER_PAIR;
+  return true;
+}
+
 static void var_declaration()
 {
-  uint8_t global = parse_variable("Expect variable name.");
+  uint16_t global = parse_variable("Expect variable name.");
+  bool is_pair = false;
   if(match(TOKEN_EQUAL)) {
     expression();
+    is_pair = pair_initializer();
   }
   else {
     emit_byte(OP_NIL);
   }
 
   consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+  if(is_pair) {
+    g_current_compiler->locals[g_current_compiler->local_count - 1].is_pair = true;
+    mark_initialized();
+    add_local(synthetic_token(""));
+  }
   define_variable(global);
 }
 
@@ -745,6 +1032,15 @@ static void function(function_type_t type)
   // No need to do end_scope() because we discard the compiler here (who cares about its locals...)
   obj_function_t *function = end_compiler();
 
+  // Upvalues hold a single value, so the pairs the closure captures have to be bound first
+  for(int i = 0; i < function->upvalue_count; i++) {
+    if(compiler.upvalues[i].is_local
+       && g_current_compiler->locals[compiler.upvalues[i].index].is_pair) {
+      emit_bytes(OP_GET_LOCAL_PAIR, compiler.upvalues[i].index);
+      emit_byte(OP_POP);
+    }
+  }
+
   // At runtime, the function object will be on the stack after parsing its declaration.
   // If it is a global function, it will be followed by a OP_DEFINE_GLOBAL instruction that pops it.
   emit_bytes(OP_CLOSURE, make_constant(OBJ_VAL(function)));
@@ -761,7 +1057,7 @@ static void fun_declaration()
   // Functions are first-class, so we parse the name like a variable.
   // Inside a block or other function, a function declaration creates a local variable.
   // At the top level, a function declaration creates a global variable.
-  uint8_t global = parse_variable("Expect function name.");
+  uint16_t global = parse_variable("Expect function name.");
   mark_initialized();      // This way a function can refer to itself in the body.
   function(TYPE_FUNCTION); // Compile the body, leaving the function object on the stack.
   define_variable(global);
@@ -823,6 +1119,25 @@ static void print_statement()
   emit_byte(OP_PRINT);
 }
 
+/* `return f(args);` has nothing left to do in the frame after the call, so the callee may take the
+frame over, see OP_TAIL_CALL. The OP_RETURN stays: a jump of `and`/`or` may land on it, and a native
+or a class without initializer returns to it like any call. */
+static void tail_call()
+{
+  compiler_t *compiler = g_current_compiler;
+  chunk_t *chunk = current_chunk();
+  if(compiler->last_call == -1 || compiler->last_call_end != chunk->count) {
+    return;
+  }
+  uint8_t *opcode = &chunk->code[compiler->last_call];
+  if(*opcode == OP_CALL) {
+    *opcode = OP_TAIL_CALL;
+  }
+  else if(*opcode == OP_INVOKE) {
+    *opcode = OP_TAIL_INVOKE;
+  }
+}
+
 static void return_statement()
 {
   if(g_current_compiler->type == TYPE_SCRIPT) {
@@ -840,6 +1155,7 @@ static void return_statement()
 
     expression();
     consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+    tail_call();
     emit_byte(OP_RETURN);
   }
 }
@@ -923,7 +1239,7 @@ static void class_declaration()
   declare_variable();
 
   emit_bytes(OP_CLASS, name_constant);
-  define_variable(name_constant);
+  define_variable(g_current_compiler->scope_depth > 0 ? 0 : global_variable(&class_name));
 
   // Track nested classes
   class_compiler_t class_compiler;
@@ -1033,8 +1349,15 @@ static void unary(bool can_assign)
   token_type_t operator_type = g_parser.previous.type;
 
   // Compile the operand
+  int operand_start = current_chunk()->count;
   parse_precedence(PREC_UNARY);
 
+  value_t operand, result;
+  if(constant_since(operand_start, &operand) && fold_unary(operator_type, operand, &result)) {
+    replace_constants(operand_start, result);
+    return;
+  }
+
   switch(operator_type) {
   case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
   case TOKEN_BANG: emit_byte(OP_NOT); break;
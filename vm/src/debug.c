@@ -1,6 +1,85 @@
 #include <debug.h>
 #include <object.h>
 #include <stdio.h>
+#include <vm.h>
+
+static const char *opcode_names[OP_COUNT] = {
+  [OP_CONSTANT] = "OP_CONSTANT",
+  [OP_NIL] = "OP_NIL",
+  [OP_TRUE] = "OP_TRUE",
+  [OP_FALSE] = "OP_FALSE",
+  [OP_POP] = "OP_POP",
+  [OP_GET_LOCAL] = "OP_GET_LOCAL",
+  [OP_SET_LOCAL] = "OP_SET_LOCAL",
+  [OP_SET_LOCAL_POP] = "OP_SET_LOCAL_POP",
+  [OP_INC_LOCAL] = "OP_INC_LOCAL",
+  [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+  [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+  [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+  [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+  [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+  [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+  [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+  [OP_GET_SUPER] = "OP_GET_SUPER",
+  [OP_GET_PROPERTY_PAIR] = "OP_GET_PROPERTY_PAIR",
+  [OP_GET_SUPER_PAIR] = "OP_GET_SUPER_PAIR",
+  [OP_GET_LOCAL_PAIR] = "OP_GET_LOCAL_PAIR",
+  [OP_EQUAL] = "OP_EQUAL",
+  [OP_GREATER] = "OP_GREATER",
+  [OP_LESS] = "OP_LESS",
+  [OP_ADD] = "OP_ADD",
+  [OP_ADD_LOCALS] = "OP_ADD_LOCALS",
+  [OP_ADD_CONSTANT] = "OP_ADD_CONSTANT",
+  [OP_SUBTRACT] = "OP_SUBTRACT",
+  [OP_MULTIPLY] = "OP_MULTIPLY",
+  [OP_DIVIDE] = "OP_DIVIDE",
+  [OP_NOT] = "OP_NOT",
+  [OP_NEGATE] = "OP_NEGATE",
+  [OP_PRINT] = "OP_PRINT",
+  [OP_JUMP] = "OP_JUMP",
+  [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+  [OP_LESS_JUMP] = "OP_LESS_JUMP",
+  [OP_LOOP] = "OP_LOOP",
+  [OP_CALL] = "OP_CALL",
+  [OP_TAIL_CALL] = "OP_TAIL_CALL",
+  [OP_CALL_PAIR] = "OP_CALL_PAIR",
+  [OP_INVOKE] = "OP_INVOKE",
+  [OP_TAIL_INVOKE] = "OP_TAIL_INVOKE",
+  [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+  [OP_CLOSURE] = "OP_CLOSURE",
+  [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+  [OP_RETURN] = "OP_RETURN",
+  [OP_CLASS] = "OP_CLASS",
+  [OP_INHERIT] = "OP_INHERIT",
+  [OP_METHOD] = "OP_METHOD",
+  [OP_REG_MOVE] = "OP_REG_MOVE",
+  [OP_REG_LOADK] = "OP_REG_LOADK",
+  [OP_REG_ADD] = "OP_REG_ADD",
+  [OP_REG_ADDK] = "OP_REG_ADDK",
+  [OP_REG_SUBTRACT] = "OP_REG_SUBTRACT",
+  [OP_REG_SUBTRACTK] = "OP_REG_SUBTRACTK",
+  [OP_REG_MULTIPLY] = "OP_REG_MULTIPLY",
+  [OP_REG_MULTIPLYK] = "OP_REG_MULTIPLYK",
+  [OP_REG_DIVIDE] = "OP_REG_DIVIDE",
+  [OP_REG_DIVIDEK] = "OP_REG_DIVIDEK",
+  [OP_REG_EQUAL] = "OP_REG_EQUAL",
+  [OP_REG_EQUALK] = "OP_REG_EQUALK",
+  [OP_REG_GREATER] = "OP_REG_GREATER",
+  [OP_REG_GREATERK] = "OP_REG_GREATERK",
+  [OP_REG_LESS] = "OP_REG_LESS",
+  [OP_REG_LESSK] = "OP_REG_LESSK",
+  [OP_REG_EQUAL_JUMP] = "OP_REG_EQUAL_JUMP",
+  [OP_REG_EQUAL_JUMPK] = "OP_REG_EQUAL_JUMPK",
+  [OP_REG_GREATER_JUMP] = "OP_REG_GREATER_JUMP",
+  [OP_REG_GREATER_JUMPK] = "OP_REG_GREATER_JUMPK",
+  [OP_REG_LESS_JUMP] = "OP_REG_LESS_JUMP",
+  [OP_REG_LESS_JUMPK] = "OP_REG_LESS_JUMPK",
+};
+
+const char *opcode_name(uint8_t opcode)
+{
+  return opcode < OP_COUNT ? opcode_names[opcode] : "OP_UNKNOWN";
+}
 
 static int simple_instruction(const char *name, int offset)
 {
@@ -22,6 +101,70 @@ static int jump_instruction(const char *name, int sign, chunk_t *chunk, int offs
   return offset + 3;
 }
 
+static int locals_instruction(const char *name, chunk_t *chunk, int offset)
+{
+  uint8_t a = chunk->code[offset + 1];
+  uint8_t b = chunk->code[offset + 2];
+  printf("%-16s %4d %4d\n", name, a, b);
+  return offset + 3;
+}
+
+static int local_constant_instruction(const char *name, chunk_t *chunk, int offset)
+{
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  printf("%-16s %4d '", name, slot);
+  print_value(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + 3;
+}
+
+static int compare_jump_instruction(const char *name, chunk_t *chunk, int offset)
+{
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  uint16_t jump = (chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
+  printf("%-16s %4d '", name, slot);
+  print_value(chunk->constants.values[constant]);
+  printf("' %4d -> %d\n", offset, offset + 5 + jump);
+  return offset + 5;
+}
+
+static void print_operand(chunk_t *chunk, bool constant, uint8_t index)
+{
+  if(constant) {
+    printf("'");
+    print_value(chunk->constants.values[index]);
+    printf("'");
+  }
+  else {
+    printf("r%d", index);
+  }
+}
+
+// Prints `dst = b, c` for the register instructions, see registers.c
+static int register_instruction(const char *name, chunk_t *chunk, int offset, int operands,
+                                bool constant)
+{
+  printf("%-16s %4d r%d = ", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+  print_operand(chunk, constant && operands == 1, chunk->code[offset + 3]);
+  if(operands == 2) {
+    printf(", ");
+    print_operand(chunk, constant, chunk->code[offset + 4]);
+  }
+  printf("\n");
+  return offset + 3 + operands;
+}
+
+static int register_jump_instruction(const char *name, chunk_t *chunk, int offset, bool constant)
+{
+  uint16_t jump = (chunk->code[offset + 5] << 8) | chunk->code[offset + 6];
+  printf("%-16s %4d r%d, ", name, chunk->code[offset + 1], chunk->code[offset + 3]);
+  print_operand(chunk, constant, chunk->code[offset + 4]);
+  printf(" if %s %4d -> %d\n", chunk->code[offset + 2] ? "true" : "false", offset, offset + 7 + jump);
+  return offset + 7;
+}
+
 static int constant_instruction(const char *name, chunk_t *chunk, int offset)
 {
   int ix = chunk->code[offset + 1];
@@ -31,16 +174,54 @@ static int constant_instruction(const char *name, chunk_t *chunk, int offset)
   return offset + 2;
 }
 
+static int global_instruction(const char *name, chunk_t *chunk, int offset)
+{
+  uint16_t slot = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+  printf("%-16s %4d '", name, slot);
+  print_value(g_vm.global_names.values[slot]);
+  printf("'\n");
+  return offset + 3;
+}
+
+static int property_instruction(const char *name, chunk_t *chunk, int offset)
+{
+  uint8_t constant = chunk->code[offset + 1];
+  uint16_t cache = (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+  printf("%-16s %4d '", name, constant);
+  print_value(chunk->constants.values[constant]);
+  printf("' [cache %d]\n", cache);
+  return offset + 4;
+}
+
 static int invoke_instruction(const char *name, chunk_t *chunk, int offset)
 {
   uint8_t constant = chunk->code[offset + 1];
   uint8_t arg_count = chunk->code[offset + 2];
-  printf("%-16s (%d args) %4d '\n", name, arg_count, constant);
+  printf("%-16s (%d args) %4d '", name, arg_count, constant);
   print_value(chunk->constants.values[constant]);
   printf("'\n");
   return offset + 3;
 }
 
+static int pair_call_instruction(const char *name, chunk_t *chunk, int offset)
+{
+  uint8_t arg_count = chunk->code[offset + 1];
+  uint8_t slot = chunk->code[offset + 2];
+  printf("%-16s (%d args) %4d\n", name, arg_count, slot);
+  return offset + 3;
+}
+
+static int cached_invoke_instruction(const char *name, chunk_t *chunk, int offset)
+{
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t arg_count = chunk->code[offset + 2];
+  uint16_t cache = (chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
+  printf("%-16s (%d args) %4d '", name, arg_count, constant);
+  print_value(chunk->constants.values[constant]);
+  printf("' [cache %d]\n", cache);
+  return offset + 5;
+}
+
 void disassemble_chunk(chunk_t *chunk, const char *name)
 {
   printf("== %s ==\n", name);
@@ -84,17 +265,23 @@ int disassemble_instruction(chunk_t *chunk, int offset)
   case OP_SET_LOCAL: {
     return byte_instruction("OP_SET_LOCAL", chunk, offset);
   }
+  case OP_SET_LOCAL_POP: {
+    return byte_instruction("OP_SET_LOCAL_POP", chunk, offset);
+  }
+  case OP_INC_LOCAL: {
+    return local_constant_instruction("OP_INC_LOCAL", chunk, offset);
+  }
 
   case OP_GET_GLOBAL: {
-    return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+    return global_instruction("OP_GET_GLOBAL", chunk, offset);
   }
 
   case OP_DEFINE_GLOBAL: {
-    return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+    return global_instruction("OP_DEFINE_GLOBAL", chunk, offset);
   }
 
   case OP_SET_GLOBAL: {
-    return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+    return global_instruction("OP_SET_GLOBAL", chunk, offset);
   }
 
   case OP_GET_UPVALUE: {
@@ -105,17 +292,29 @@ int disassemble_instruction(chunk_t *chunk, int offset)
   }
 
   case OP_SET_PROPERTY: {
-    return constant_instruction("OP_SET_PROPERTY", chunk, offset);
+    return property_instruction("OP_SET_PROPERTY", chunk, offset);
   }
 
   case OP_GET_PROPERTY: {
-    return constant_instruction("OP_GET_PROPERTY", chunk, offset);
+    return property_instruction("OP_GET_PROPERTY", chunk, offset);
   }
 
   case OP_GET_SUPER: {
     return constant_instruction("OP_GET_SUPER", chunk, offset);
   }
 
+  case OP_GET_PROPERTY_PAIR: {
+    return property_instruction("OP_GET_PROPERTY_PAIR", chunk, offset);
+  }
+
+  case OP_GET_SUPER_PAIR: {
+    return constant_instruction("OP_GET_SUPER_PAIR", chunk, offset);
+  }
+
+  case OP_GET_LOCAL_PAIR: {
+    return byte_instruction("OP_GET_LOCAL_PAIR", chunk, offset);
+  }
+
   case OP_EQUAL: {
     return simple_instruction("OP_EQUAL", offset);
   }
@@ -128,6 +327,12 @@ int disassemble_instruction(chunk_t *chunk, int offset)
   case OP_ADD: {
     return simple_instruction("OP_ADD", offset);
   }
+  case OP_ADD_LOCALS: {
+    return locals_instruction("OP_ADD_LOCALS", chunk, offset);
+  }
+  case OP_ADD_CONSTANT: {
+    return constant_instruction("OP_ADD_CONSTANT", chunk, offset);
+  }
   case OP_SUBTRACT: {
     return simple_instruction("OP_SUBTRACT", offset);
   }
@@ -155,6 +360,10 @@ int disassemble_instruction(chunk_t *chunk, int offset)
     return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
   }
 
+  case OP_LESS_JUMP: {
+    return compare_jump_instruction("OP_LESS_JUMP", chunk, offset);
+  }
+
   case OP_LOOP: {
     return jump_instruction("OP_LOOP", -1, chunk, offset);
   }
@@ -163,8 +372,20 @@ int disassemble_instruction(chunk_t *chunk, int offset)
     return byte_instruction("OP_CALL", chunk, offset);
   }
 
+  case OP_TAIL_CALL: {
+    return byte_instruction("OP_TAIL_CALL", chunk, offset);
+  }
+
+  case OP_CALL_PAIR: {
+    return pair_call_instruction("OP_CALL_PAIR", chunk, offset);
+  }
+
   case OP_INVOKE: {
-    return invoke_instruction("OP_INVOKE", chunk, offset);
+    return cached_invoke_instruction("OP_INVOKE", chunk, offset);
+  }
+
+  case OP_TAIL_INVOKE: {
+    return cached_invoke_instruction("OP_TAIL_INVOKE", chunk, offset);
   }
 
   case OP_SUPER_INVOKE: {
@@ -209,6 +430,73 @@ int disassemble_instruction(chunk_t *chunk, int offset)
     return constant_instruction("OP_METHOD", chunk, offset);
   }
 
+  case OP_REG_MOVE: {
+    return register_instruction("OP_REG_MOVE", chunk, offset, 1, false);
+  }
+  case OP_REG_LOADK: {
+    return register_instruction("OP_REG_LOADK", chunk, offset, 1, true);
+  }
+  case OP_REG_ADD: {
+    return register_instruction("OP_REG_ADD", chunk, offset, 2, false);
+  }
+  case OP_REG_ADDK: {
+    return register_instruction("OP_REG_ADDK", chunk, offset, 2, true);
+  }
+  case OP_REG_SUBTRACT: {
+    return register_instruction("OP_REG_SUBTRACT", chunk, offset, 2, false);
+  }
+  case OP_REG_SUBTRACTK: {
+    return register_instruction("OP_REG_SUBTRACTK", chunk, offset, 2, true);
+  }
+  case OP_REG_MULTIPLY: {
+    return register_instruction("OP_REG_MULTIPLY", chunk, offset, 2, false);
+  }
+  case OP_REG_MULTIPLYK: {
+    return register_instruction("OP_REG_MULTIPLYK", chunk, offset, 2, true);
+  }
+  case OP_REG_DIVIDE: {
+    return register_instruction("OP_REG_DIVIDE", chunk, offset, 2, false);
+  }
+  case OP_REG_DIVIDEK: {
+    return register_instruction("OP_REG_DIVIDEK", chunk, offset, 2, true);
+  }
+  case OP_REG_EQUAL: {
+    return register_instruction("OP_REG_EQUAL", chunk, offset, 2, false);
+  }
+  case OP_REG_EQUALK: {
+    return register_instruction("OP_REG_EQUALK", chunk, offset, 2, true);
+  }
+  case OP_REG_GREATER: {
+    return register_instruction("OP_REG_GREATER", chunk, offset, 2, false);
+  }
+  case OP_REG_GREATERK: {
+    return register_instruction("OP_REG_GREATERK", chunk, offset, 2, true);
+  }
+  case OP_REG_LESS: {
+    return register_instruction("OP_REG_LESS", chunk, offset, 2, false);
+  }
+  case OP_REG_LESSK: {
+    return register_instruction("OP_REG_LESSK", chunk, offset, 2, true);
+  }
+  case OP_REG_EQUAL_JUMP: {
+    return register_jump_instruction("OP_REG_EQUAL_JUMP", chunk, offset, false);
+  }
+  case OP_REG_EQUAL_JUMPK: {
+    return register_jump_instruction("OP_REG_EQUAL_JUMPK", chunk, offset, true);
+  }
+  case OP_REG_GREATER_JUMP: {
+    return register_jump_instruction("OP_REG_GREATER_JUMP", chunk, offset, false);
+  }
+  case OP_REG_GREATER_JUMPK: {
+    return register_jump_instruction("OP_REG_GREATER_JUMPK", chunk, offset, true);
+  }
+  case OP_REG_LESS_JUMP: {
+    return register_jump_instruction("OP_REG_LESS_JUMP", chunk, offset, false);
+  }
+  case OP_REG_LESS_JUMPK: {
+    return register_jump_instruction("OP_REG_LESS_JUMPK", chunk, offset, true);
+  }
+
   default: {
     printf("Unknown opcode %d\n", instruction);
     return offset + 1;
@@ -0,0 +1,219 @@
+#include <gc_stats.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vm.h>
+
+static const char *type_names[OBJ_TYPE_COUNT] = {
+  [OBJ_BOUND_METHOD] = "bound_method",
+  [OBJ_CLASS] = "class",
+  [OBJ_CLOSURE] = "closure",
+  [OBJ_FUNCTION] = "function",
+  [OBJ_INSTANCE] = "instance",
+  [OBJ_NATIVE] = "native",
+  [OBJ_SHAPE] = "shape",
+  [OBJ_STRING] = "string",
+  [OBJ_UPVALUE] = "upvalue",
+};
+
+static const char *kind_names[] = {
+  [GC_MINOR] = "minor",
+  [GC_MAJOR] = "major",
+  [GC_INCREMENTAL] = "incremental",
+};
+
+static const char *pause_names[GC_PAUSE_KINDS] = {
+  [GC_PAUSE_MINOR] = "minor",
+  [GC_PAUSE_MAJOR] = "major",
+  [GC_PAUSE_STEP] = "step",
+};
+
+double now_us()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+void enable_gc_stats()
+{
+  // Like the gray stack, the records live outside of the heap they describe
+  if(g_vm.gc_stats != NULL) {
+    return;
+  }
+  gc_stats_t *stats = calloc(1, sizeof(gc_stats_t));
+  if(stats == NULL) {
+    exit(1);
+  }
+  stats->major = -1;
+  stats->epoch = now_us();
+  g_vm.gc_stats = stats;
+}
+
+void free_gc_stats()
+{
+  if(g_vm.gc_stats != NULL) {
+    free(g_vm.gc_stats->cycles);
+    free(g_vm.gc_stats);
+    g_vm.gc_stats = NULL;
+  }
+}
+
+gc_cycle_t *gc_cycle_begin(gc_kind_t kind)
+{
+  gc_stats_t *stats = g_vm.gc_stats;
+  if(stats == NULL) {
+    return NULL;
+  }
+  if(kind != GC_MINOR && stats->major != -1) {
+    // A full collection abandoning an incremental cycle takes its record over
+    gc_cycle_t *cycle = &stats->cycles[stats->major];
+    cycle->kind = kind;
+    return cycle;
+  }
+
+  if(stats->count == stats->capacity) {
+    stats->capacity = GROW_CAPACITY(stats->capacity);
+    stats->cycles = realloc(stats->cycles, sizeof(gc_cycle_t) * stats->capacity);
+    if(stats->cycles == NULL) {
+      exit(1);
+    }
+  }
+  gc_cycle_t *cycle = &stats->cycles[stats->count];
+  *cycle = (gc_cycle_t){0};
+  cycle->kind = kind;
+  cycle->start = now_us() - stats->epoch;
+  cycle->bytes_before = g_vm.bytes_allocated;
+  if(kind != GC_MINOR) {
+    stats->major = stats->count;
+  }
+  stats->count++;
+  return cycle;
+}
+
+gc_cycle_t *gc_major_cycle()
+{
+  // Records move as the array grows, so the open one is looked up each time
+  gc_stats_t *stats = g_vm.gc_stats;
+  if(stats == NULL || stats->major == -1) {
+    return NULL;
+  }
+  return &stats->cycles[stats->major];
+}
+
+void gc_cycle_end(gc_cycle_t *cycle)
+{
+  if(cycle == NULL) {
+    return;
+  }
+  cycle->bytes_after = g_vm.bytes_allocated;
+  cycle->next_gc = g_vm.next_gc;
+  if(cycle->kind != GC_MINOR) {
+    g_vm.gc_stats->major = -1;
+  }
+}
+
+void gc_record_pause(gc_pause_t kind, double start)
+{
+  gc_stats_t *stats = g_vm.gc_stats;
+  if(stats == NULL) {
+    return;
+  }
+  double pause = now_us() - start;
+  int bucket = 0;
+  while(bucket < GC_PAUSE_BUCKETS - 1 && pause >= (double)(1 << bucket)) {
+    bucket++;
+  }
+  stats->pauses[kind][bucket]++;
+  if(pause > stats->max_pause) {
+    stats->max_pause = pause;
+  }
+}
+
+static void census_list(gc_census_t *census, obj_t *object)
+{
+  for(; object != NULL; object = object->next) {
+    census->objects[object->type]++;
+    census->bytes[object->type] += object_size(object);
+  }
+}
+
+// Counts the objects in the heap. During a lazy sweep, this includes the garbage not freed yet.
+void gc_census(gc_census_t *census)
+{
+  *census = (gc_census_t){0};
+  census_list(census, g_vm.objects);
+  census_list(census, g_vm.young_objects);
+}
+
+void print_gc_pauses()
+{
+  gc_stats_t *stats = g_vm.gc_stats;
+  for(int kind = 0; kind < GC_PAUSE_KINDS; kind++) {
+    printf("-- %s gc pauses:", pause_names[kind]);
+    for(int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+      if(stats->pauses[kind][i] > 0) {
+        printf(" <%dus: %zu", 1 << i, stats->pauses[kind][i]);
+      }
+    }
+    printf("\n");
+  }
+  printf("-- max gc pause: %.1fus\n", stats->max_pause);
+}
+
+static void print_by_type(FILE *out, const size_t *counts)
+{
+  fprintf(out, "{");
+  for(int type = 0; type < OBJ_TYPE_COUNT; type++) {
+    fprintf(out, "%s\"%s\": %zu", type > 0 ? ", " : "", type_names[type], counts[type]);
+  }
+  fprintf(out, "}");
+}
+
+/* Dumps everything as JSON:
+
+  {"bytes_allocated": .., "next_gc": .., "census": {..}, "pauses": {..}, "cycles": [..]}
+
+Pause histograms are arrays of GC_PAUSE_BUCKETS counts, see gc_stats_t. */
+void print_gc_stats(FILE *out)
+{
+  gc_stats_t *stats = g_vm.gc_stats;
+  if(stats == NULL) {
+    return;
+  }
+
+  fprintf(out, "{\n  \"bytes_allocated\": %zu,\n  \"next_gc\": %zu,\n", g_vm.bytes_allocated,
+          g_vm.next_gc);
+
+  gc_census_t census;
+  gc_census(&census);
+  fprintf(out, "  \"census\": {\n    \"objects\": ");
+  print_by_type(out, census.objects);
+  fprintf(out, ",\n    \"bytes\": ");
+  print_by_type(out, census.bytes);
+  fprintf(out, "\n  },\n");
+
+  fprintf(out, "  \"pauses\": {\n");
+  for(int kind = 0; kind < GC_PAUSE_KINDS; kind++) {
+    fprintf(out, "    \"%s\": [", pause_names[kind]);
+    for(int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+      fprintf(out, "%s%zu", i > 0 ? ", " : "", stats->pauses[kind][i]);
+    }
+    fprintf(out, "],\n");
+  }
+  fprintf(out, "    \"max_us\": %.1f\n  },\n", stats->max_pause);
+
+  fprintf(out, "  \"cycles\": [");
+  for(int i = 0; i < stats->count; i++) {
+    gc_cycle_t *cycle = &stats->cycles[i];
+    fprintf(out,
+            "%s\n    {\"kind\": \"%s\", \"start_us\": %.1f, \"bytes_before\": %zu, "
+            "\"bytes_after\": %zu, \"mark_us\": %.1f, \"sweep_us\": %.1f, \"next_gc\": %zu, "
+            "\"freed\": ",
+            i > 0 ? "," : "", kind_names[cycle->kind], cycle->start, cycle->bytes_before,
+            cycle->bytes_after, cycle->mark_us, cycle->sweep_us, cycle->next_gc);
+    print_by_type(out, cycle->freed);
+    fprintf(out, "}");
+  }
+  fprintf(out, "%s]\n}\n", stats->count > 0 ? "\n  " : "");
+}
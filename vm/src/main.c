@@ -48,35 +48,158 @@ static char *read_file(const char *path)
   return buffer;
 }
 
-static void run_file(const char *path)
+// Returns the exit status. The VM is freed by the caller in any case, which prints the collector
+// statistics when asked to.
+static int run_file(const char *path)
 {
   char *source = read_file(path);
   interpret_result_t result = interpret(source);
   free(source);
 
   if(result == INTERPRET_COMPILE_ERROR) {
-    exit(EX_DATAERR);
+    return EX_DATAERR;
   }
-  else if(result == INTERPRET_RUNTIME_ERROR) {
-    exit(EX_SOFTWARE);
+  if(result == INTERPRET_RUNTIME_ERROR) {
+    return EX_SOFTWARE;
   }
+  return 0;
+}
+
+static void usage(const char *program)
+{
+  fprintf(stderr, "Usage: %s [options] [script]\n", program);
+  fprintf(stderr,
+          "  --registers           compile to register instructions instead of stack code\n");
+  fprintf(stderr,
+          "  --gc-incremental      mark the heap in small steps during major collections\n");
+  fprintf(stderr,
+          "  --gc-step=N           budget of an incremental step, in objects (default %d)\n",
+          GC_STEP_OBJECTS);
+  fprintf(stderr, "  --gc-step-us=N        budget of an incremental step, in microseconds\n");
+  fprintf(stderr, "  --gc-stats            print collector statistics as JSON to stderr at exit\n");
+  fprintf(stderr, "  --gc-initial=SIZE     heap size of the first major collection (default %dM)\n",
+          GC_INITIAL_HEAP >> 20);
+  fprintf(stderr,
+          "  --gc-growth=F         growth of the heap between major collections (default %d)\n",
+          GC_HEAP_GROWTH_FACTOR);
+  fprintf(stderr, "  --gc-min-heap=SIZE    never collect the heap below this size\n");
+  fprintf(stderr, "  --gc-soft-limit=SIZE  collect more often past this size\n");
+  fprintf(stderr, "  --gc-max-heap=SIZE    fail with an out of memory error past this size\n");
+#ifdef POOL_ALLOCATOR
+  fprintf(stderr,
+          "  --gc-compact=R        compact the heap when a share R of the pooled memory is free\n");
+#endif
+#ifdef PARALLEL_MARK
+  fprintf(stderr, "  --gc-threads=N        threads marking the heap in major collections\n");
+#endif
+  fprintf(stderr, "Sizes are in bytes, or in K, M or G when followed by the unit.\n");
+  exit(EX_USAGE);
+}
+
+// Parses the value of an option like --name=N, which must be a positive number. Sizes may end with
+// a unit.
+static double parse_option(const char *arg, const char *name, const char *program, bool size)
+{
+  size_t length = strlen(name);
+  if(strncmp(arg, name, length) != 0 || arg[length] != '=') {
+    return -1;
+  }
+  char *end;
+  double value = strtod(arg + length + 1, &end);
+  if(size && *end != '\0' && end[1] == '\0') {
+    switch(*end++) {
+    case 'K': value *= 1024; break;
+    case 'M': value *= 1024 * 1024; break;
+    case 'G': value *= 1024 * 1024 * 1024; break;
+    default: usage(program);
+    }
+  }
+  if(*end != '\0' || value <= 0) {
+    usage(program);
+  }
+  return value;
+}
+
+static double option_value(const char *arg, const char *name, const char *program)
+{
+  return parse_option(arg, name, program, false);
+}
+
+static double option_size(const char *arg, const char *name, const char *program)
+{
+  return parse_option(arg, name, program, true);
 }
 
 int main(int argc, char *argv[])
 {
   init_vm();
 
-  if(argc == 1) {
+  int arg = 1;
+  for(; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    double value;
+    if(strcmp(argv[arg], "--registers") == 0) {
+      g_vm.register_backend = true;
+    }
+    else if(strcmp(argv[arg], "--gc-incremental") == 0) {
+      g_vm.gc_incremental = true;
+    }
+    else if(strcmp(argv[arg], "--gc-stats") == 0) {
+      enable_gc_stats();
+      g_vm.gc_stats_dump = true;
+    }
+    else if((value = option_value(argv[arg], "--gc-step", argv[0])) > 0) {
+      g_vm.gc_step_objects = (int)value;
+    }
+    else if((value = option_value(argv[arg], "--gc-step-us", argv[0])) > 0) {
+      g_vm.gc_step_us = value;
+    }
+    else if((value = option_size(argv[arg], "--gc-initial", argv[0])) > 0) {
+      g_vm.next_gc = (size_t)value;
+    }
+    else if((value = option_value(argv[arg], "--gc-growth", argv[0])) > 0) {
+      if(value < 1) {
+        usage(argv[0]);
+      }
+      g_vm.gc_growth = value;
+    }
+    else if((value = option_size(argv[arg], "--gc-min-heap", argv[0])) > 0) {
+      g_vm.gc_min_heap = (size_t)value;
+    }
+    else if((value = option_size(argv[arg], "--gc-soft-limit", argv[0])) > 0) {
+      g_vm.gc_soft_limit = (size_t)value;
+    }
+    else if((value = option_size(argv[arg], "--gc-max-heap", argv[0])) > 0) {
+      g_vm.gc_max_heap = (size_t)value;
+    }
+#ifdef POOL_ALLOCATOR
+    else if((value = option_value(argv[arg], "--gc-compact", argv[0])) > 0) {
+      g_vm.gc_compact = value;
+    }
+#endif
+#ifdef PARALLEL_MARK
+    else if((value = option_value(argv[arg], "--gc-threads", argv[0])) > 0) {
+      g_vm.gc_threads = value < GC_MAX_THREADS ? (int)value : GC_MAX_THREADS;
+    }
+#endif
+    else {
+      usage(argv[0]);
+    }
+  }
+  if(g_vm.next_gc < g_vm.gc_min_heap) {
+    g_vm.next_gc = g_vm.gc_min_heap;
+  }
+
+  int status = 0;
+  if(arg == argc) {
     repl();
   }
-  else if(argc == 2) {
-    run_file(argv[1]);
+  else if(arg == argc - 1) {
+    status = run_file(argv[arg]);
   }
   else {
-    fprintf(stderr, "Usage: %s [script]\n", argv[0]);
-    exit(EX_USAGE);
+    usage(argv[0]);
   }
 
   free_vm();
-  return 0;
+  return status;
 }
\ No newline at end of file
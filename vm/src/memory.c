@@ -1,6 +1,9 @@
 #include <compiler.h>
+#include <gc_stats.h>
 #include <memory.h>
+#include <pool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vm.h>
 
 #ifdef DEBUG_LOG_GC
@@ -8,22 +11,144 @@
 #include <stdio.h>
 #endif
 
-#define GC_HEAP_GROWTH_FACTOR 2
+#ifdef PARALLEL_MARK
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define GC_NURSERY_SIZE (256 * 1024)
+
+/* The collector is generational. New objects are allocated in the nursery, which is collected on
+its own by frequent minor collections: the survivors are promoted to the old generation, which is
+only collected by the full (major) collections.
+Mark bits are sticky: an object keeps its bit set after surviving a collection, so between
+collections the marked objects are exactly the old ones, and a minor collection doesn't trace
+them. The exception are old objects that got a reference to a young one stored into them since the
+last collection: the write barrier puts them in the remembered set, whose objects are traced like
+roots.
+Major collections can also be incremental. A cycle starts when the heap crosses the threshold: a
+clearing phase resets the old marks, then a marking phase traces the heap; both advance by a
+bounded step at each allocation, and no minor collection runs in between. The objects allocated
+meanwhile start white. The write barrier keeps the tri-color invariant: when the program stores a
+white object into a marked (gray or black) one, the owner is remembered and blackened again by a
+later step. The roots have no barrier, so the last step scans them again.
+Sweeping is lazy, whichever way the heap was marked: the nursery joins the old list, whose white
+objects are then freed a chunk at each allocation. Minor collections go on meanwhile, since the
+unswept white objects are unreachable, but the next major one waits for the sweep to end. */
+
+static void gc_step();
+static void start_cycle();
+static void sweep(bool bounded);
+static void enforce_heap_limit();
+
+#ifdef POOL_ALLOCATOR
+// Like realloc(), but small blocks live in the pools: the old size tells where the block is.
+static void *resize_block(void *pointer, size_t old_size, size_t new_size)
+{
+  bool old_pooled = pointer != NULL && old_size <= POOL_MAX_SIZE;
+  if(new_size == 0) {
+    if(old_pooled) {
+      pool_free(pointer, old_size);
+    }
+    else {
+      free(pointer);
+    }
+    return NULL;
+  }
+
+  if(new_size > POOL_MAX_SIZE && !old_pooled) {
+    void *result = realloc(pointer, new_size);
+    if(result == NULL) {
+      exit(1);
+    }
+    return result;
+  }
+  if(old_pooled && new_size <= POOL_MAX_SIZE && POOL_CLASS(old_size) == POOL_CLASS(new_size)) {
+    return pointer;
+  }
+
+  // The block moves between size classes, or between the pools and malloc()
+  void *result = new_size <= POOL_MAX_SIZE ? pool_alloc(new_size) : malloc(new_size);
+  if(result == NULL) {
+    exit(1);
+  }
+  if(pointer != NULL) {
+    memcpy(result, pointer, old_size < new_size ? old_size : new_size);
+    if(old_pooled) {
+      pool_free(pointer, old_size);
+    }
+    else {
+      free(pointer);
+    }
+  }
+  return result;
+}
+#endif
+
+#ifdef PARALLEL_MARK
+#define GC_SHARE_THRESHOLD 64 // Private gray objects past which a marking thread shares some
+#define GC_STEAL_MAX 64
+
+/* Each thread of a parallel mark has its own gray deque. The owner pushes and pops the private end
+[split, count) without locking, like the serial gray stack. The shared end [head, split) is where
+the other threads steal from, taking the oldest objects, which tend to lead to the largest
+subgraphs. The owner moves objects between the two parts, and thieves take them, holding the lock.
+Mark bits are set with an atomic exchange, so each object is traced by a single thread. */
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  obj_t **items;
+  int capacity;
+  int head;
+  int split;
+  int count;
+} mark_worker_t;
+
+static mark_worker_t *workers;
+static int worker_count;
+static int idle_workers;
+static _Thread_local mark_worker_t *t_worker; // Set while a thread takes part in a parallel mark
+
+static void worker_push(mark_worker_t *worker, obj_t *object);
+#endif
 
 void *reallocate(void *pointer, size_t old_size, size_t new_size)
 {
   g_vm.bytes_allocated += new_size - old_size;
 
+  // Only growing allocations collect: freeing happens during the sweep as well.
   if(new_size > old_size) {
+    g_vm.nursery_bytes += new_size - old_size;
+    if(g_vm.gc_max_heap > 0 && g_vm.bytes_allocated > g_vm.gc_max_heap) {
+      enforce_heap_limit();
+    }
+    else if(g_vm.gc_phase == GC_CLEARING || g_vm.gc_phase == GC_MARKING) {
+      gc_step();
+    }
+    else {
+      if(g_vm.gc_phase == GC_SWEEPING) {
+        sweep(true);
+      }
 #ifdef DEBUG_STRESS_GC
-    collect_garbage();
+      collect_nursery();
 #endif
+      if(g_vm.gc_phase == GC_IDLE && g_vm.bytes_allocated > g_vm.next_gc) {
+        if(g_vm.gc_incremental) {
+          start_cycle();
+        }
+        else {
+          collect_garbage();
+        }
+      }
+      else if(g_vm.nursery_bytes > GC_NURSERY_SIZE) {
+        collect_nursery();
+      }
+    }
   }
 
-  if(g_vm.bytes_allocated > g_vm.next_gc) {
-    collect_garbage();
-  }
-
+#ifdef POOL_ALLOCATOR
+  return resize_block(pointer, old_size, new_size);
+#else
   if(new_size == 0) {
     free(pointer);
     return NULL;
@@ -34,6 +159,7 @@ void *reallocate(void *pointer, size_t old_size, size_t new_size)
     exit(1);
   }
   return result;
+#endif
 }
 
 void free_object(obj_t *object)
@@ -44,7 +170,7 @@ void free_object(obj_t *object)
 
   switch(object->type) {
   case OBJ_STRING: {
-    FREE(char, object); // FAM
+    reallocate(object, sizeof(obj_string_t) + ((obj_string_t *)object)->length + 1, 0); // FAM
     break;
   }
   case OBJ_FUNCTION: {
@@ -89,22 +215,61 @@ void free_object(obj_t *object)
 
   case OBJ_INSTANCE: {
     obj_instance_t *instance = (obj_instance_t *)object;
-    free_table(&instance->fields);
-    FREE(obj_instance_t, object);
+    if(instance->fields != instance->inline_fields) {
+      FREE_ARRAY(value_t, instance->fields, instance->capacity);
+    }
+    reallocate(object, sizeof(obj_instance_t) + sizeof(value_t) * instance->inline_count, 0); // FAM
+    break;
+  }
+
+  case OBJ_SHAPE: {
+    // A slots table shared along a chain of shapes belongs to the topmost one, which the others
+    // keep alive through their parent pointers.
+    obj_shape_t *shape = (obj_shape_t *)object;
+    if(shape->owns_slots) {
+      free_table(shape->slots);
+      FREE(table_t, shape->slots);
+    }
+    free_table(&shape->transitions);
+    FREE(obj_shape_t, object);
     break;
   }
   }
 }
 
-void free_objects()
+// Size of the block of the object itself
+size_t object_size(obj_t *object)
+{
+  switch(object->type) {
+  case OBJ_BOUND_METHOD: return sizeof(obj_bound_method_t);
+  case OBJ_CLASS: return sizeof(obj_class_t);
+  case OBJ_CLOSURE: return sizeof(obj_closure_t);
+  case OBJ_FUNCTION: return sizeof(obj_function_t);
+  case OBJ_INSTANCE:
+    return sizeof(obj_instance_t) + sizeof(value_t) * ((obj_instance_t *)object)->inline_count;
+  case OBJ_NATIVE: return sizeof(obj_native_t);
+  case OBJ_SHAPE: return sizeof(obj_shape_t);
+  case OBJ_STRING: return sizeof(obj_string_t) + ((obj_string_t *)object)->length + 1;
+  case OBJ_UPVALUE: return sizeof(obj_upvalue_t);
+  }
+  return 0; // Unreachable
+}
+
+static void free_list(obj_t *o)
 {
-  obj_t *o = g_vm.objects;
   while(o != NULL) {
     obj_t *next = o->next;
     free_object(o);
     o = next;
   }
+}
+
+void free_objects()
+{
+  free_list(g_vm.young_objects);
+  free_list(g_vm.objects);
   free(g_vm.gray_stack);
+  free(g_vm.remembered);
 }
 
 void mark_object(obj_t *object)
@@ -112,6 +277,15 @@ void mark_object(obj_t *object)
   if(object == NULL) {
     return;
   }
+#ifdef PARALLEL_MARK
+  if(t_worker != NULL) {
+    if(!__atomic_load_n(&object->is_marked, __ATOMIC_RELAXED) &&
+       !__atomic_exchange_n(&object->is_marked, true, __ATOMIC_RELAXED)) {
+      worker_push(t_worker, object);
+    }
+    return;
+  }
+#endif
   // Don't add an already gray object
   if(object->is_marked) {
     return;
@@ -136,6 +310,29 @@ void mark_object(obj_t *object)
   g_vm.gray_stack[g_vm.gray_count++] = object;
 }
 
+void remember_object(obj_t *object)
+{
+  object->is_remembered = true;
+  if(g_vm.remembered_capacity < g_vm.remembered_count + 1) {
+    g_vm.remembered_capacity = GROW_CAPACITY(g_vm.remembered_capacity);
+    // Not managed by the GC either, like the gray stack
+    g_vm.remembered =
+        (obj_t **)realloc(g_vm.remembered, sizeof(obj_t *) * g_vm.remembered_capacity);
+    if(g_vm.remembered == NULL) {
+      exit(1);
+    }
+  }
+  g_vm.remembered[g_vm.remembered_count++] = object;
+}
+
+static void forget_remembered()
+{
+  for(int i = 0; i < g_vm.remembered_count; i++) {
+    g_vm.remembered[i]->is_remembered = false;
+  }
+  g_vm.remembered_count = 0;
+}
+
 void mark_value(value_t value)
 {
   if(IS_OBJ(value)) {
@@ -150,6 +347,20 @@ static void mark_array(value_array_t *array)
   }
 }
 
+static void mark_inline_caches(chunk_t *chunk)
+{
+  /* Cached shapes are compared by address, so they must not be collected while cached: a new
+  shape allocated at the same address would hit a stale entry. */
+  for(int i = 0; i < chunk->cache_count; i++) {
+    inline_cache_t *cache = &chunk->caches[i];
+    for(int j = 0; j < cache->count; j++) {
+      mark_object((obj_t *)cache->entries[j].shape);
+      mark_object((obj_t *)cache->entries[j].method);
+      mark_object((obj_t *)cache->entries[j].transition);
+    }
+  }
+}
+
 static void blacken_object(obj_t *object)
 {
 #ifdef DEBUG_LOG_GC
@@ -172,13 +383,31 @@ static void blacken_object(obj_t *object)
     obj_class_t *klass = (obj_class_t *)object;
     mark_object((obj_t *)klass->name);
     mark_table(&klass->methods);
+    mark_object((obj_t *)klass->shape);
     break;
   }
 
   case OBJ_INSTANCE: {
     obj_instance_t *instance = (obj_instance_t *)object;
     mark_object((obj_t *)instance->klass);
-    mark_table(&instance->fields);
+    mark_object((obj_t *)instance->shape);
+    // Slots past the field count of the shape are not initialized yet
+    for(int i = 0; i < instance->shape->field_count; i++) {
+      mark_value(instance->fields[i]);
+    }
+    break;
+  }
+
+  case OBJ_SHAPE: {
+    // Children are reachable through the transitions, so the whole tree lives as long as its
+    // class or any instance still uses one of its shapes.
+    obj_shape_t *shape = (obj_shape_t *)object;
+    mark_object((obj_t *)shape->parent);
+    mark_object((obj_t *)shape->name);
+    mark_table(&shape->transitions);
+    if(shape->owns_slots) {
+      mark_table(shape->slots);
+    }
     break;
   }
 
@@ -195,6 +424,7 @@ static void blacken_object(obj_t *object)
     obj_function_t *function = (obj_function_t *)object;
     mark_object((obj_t *)function->name);
     mark_array(&function->chunk.constants);
+    mark_inline_caches(&function->chunk);
     break;
   }
   case OBJ_UPVALUE: {
@@ -227,8 +457,9 @@ static void mark_roots()
     mark_object((obj_t *)upvalue);
   }
 
-  // Globals are also roots
-  mark_table(&g_vm.globals);
+  // Globals are also roots. The keys of the slots table are the names.
+  mark_array(&g_vm.global_names);
+  mark_array(&g_vm.global_values);
 
   // Variables allocated by the compiler are also roots
   mark_compiler_roots();
@@ -238,7 +469,7 @@ static void mark_roots()
   The right phase to remove them is between the mark and sweep phases */
 
   // This one is special, it must stick around.
-  mark_object((obj_t *)&g_vm.init_string);
+  mark_object((obj_t *)g_vm.init_string);
 }
 
 static void trace_references()
@@ -250,52 +481,745 @@ static void trace_references()
   }
 }
 
-static void sweep()
+#ifdef PARALLEL_MARK
+static void worker_push(mark_worker_t *worker, obj_t *object)
+{
+  if(worker->count == worker->capacity) {
+    pthread_mutex_lock(&worker->lock);
+    // Reuse the room of the stolen objects before growing
+    int stolen = worker->head;
+    if(stolen > 0) {
+      memmove(worker->items, worker->items + stolen, sizeof(obj_t *) * (worker->count - stolen));
+      __atomic_store_n(&worker->head, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&worker->split, worker->split - stolen, __ATOMIC_RELAXED);
+      worker->count -= stolen;
+    }
+    if(worker->count == worker->capacity) {
+      worker->capacity = GROW_CAPACITY(worker->capacity);
+      worker->items = (obj_t **)realloc(worker->items, sizeof(obj_t *) * worker->capacity);
+      if(worker->items == NULL) {
+        exit(1);
+      }
+    }
+    pthread_mutex_unlock(&worker->lock);
+  }
+  worker->items[worker->count++] = object;
+
+  // Share the older objects once the thieves have taken all the previous ones
+  if(worker->count - worker->split > GC_SHARE_THRESHOLD &&
+     __atomic_load_n(&worker->head, __ATOMIC_RELAXED) == worker->split) {
+    pthread_mutex_lock(&worker->lock);
+    __atomic_store_n(&worker->split, worker->count - GC_SHARE_THRESHOLD / 2, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&worker->lock);
+  }
+}
+
+static obj_t *worker_pop(mark_worker_t *worker)
+{
+  if(worker->count > worker->split) {
+    return worker->items[--worker->count];
+  }
+  // Take back what was shared but not stolen yet
+  obj_t *object = NULL;
+  pthread_mutex_lock(&worker->lock);
+  if(worker->head < worker->split) {
+    __atomic_store_n(&worker->split, worker->split - 1, __ATOMIC_RELAXED);
+    worker->count = worker->split;
+    object = worker->items[worker->count];
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return object;
+}
+
+static bool has_shared(mark_worker_t *worker)
 {
-  obj_t *previous = NULL;
-  obj_t *object = g_vm.objects;
+  return __atomic_load_n(&worker->head, __ATOMIC_RELAXED) <
+         __atomic_load_n(&worker->split, __ATOMIC_RELAXED);
+}
+
+static bool steal(mark_worker_t *thief)
+{
+  int index = (int)(thief - workers);
+  int count = __atomic_load_n(&worker_count, __ATOMIC_SEQ_CST);
+  for(int i = 1; i < count; i++) {
+    mark_worker_t *victim = &workers[(index + i) % count];
+    if(!has_shared(victim)) {
+      continue;
+    }
+    // Half of the shared objects are copied out, since pushing them may lock the thief's deque
+    obj_t *stolen[GC_STEAL_MAX];
+    pthread_mutex_lock(&victim->lock);
+    int taken = (victim->split - victim->head + 1) / 2;
+    if(taken > GC_STEAL_MAX) {
+      taken = GC_STEAL_MAX;
+    }
+    memcpy(stolen, victim->items + victim->head, sizeof(obj_t *) * taken);
+    __atomic_store_n(&victim->head, victim->head + taken, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&victim->lock);
+
+    for(int j = 0; j < taken; j++) {
+      worker_push(thief, stolen[j]);
+    }
+    if(taken > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *mark_worker(void *arg)
+{
+  mark_worker_t *worker = (mark_worker_t *)arg;
+  t_worker = worker;
+  for(;;) {
+    obj_t *object;
+    while((object = worker_pop(worker)) != NULL) {
+      blacken_object(object);
+    }
+    if(steal(worker)) {
+      continue;
+    }
+
+    /* An idle thread has an empty deque and pushes nothing, so once all of them are idle the
+    marking is over. Until then, some work may still show up in the shared parts. */
+    __atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+    for(;;) {
+      int count = __atomic_load_n(&worker_count, __ATOMIC_SEQ_CST);
+      if(__atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST) == count) {
+        t_worker = NULL;
+        return NULL;
+      }
+      bool found = false;
+      for(int i = 0; i < count && !found; i++) {
+        found = has_shared(&workers[i]);
+      }
+      if(found) {
+        __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+        break;
+      }
+      sched_yield();
+    }
+  }
+}
+
+// Drains the gray stack like trace_references(), on g_vm.gc_threads threads. The calling thread
+// takes part and owns the gray objects to begin with, the others start by stealing them.
+static void trace_parallel()
+{
+  mark_worker_t pool[GC_MAX_THREADS];
+  workers = pool;
+  worker_count = g_vm.gc_threads;
+  idle_workers = 0;
+  for(int i = 0; i < worker_count; i++) {
+    pthread_mutex_init(&workers[i].lock, NULL);
+    workers[i].items = NULL;
+    workers[i].capacity = 0;
+    workers[i].head = 0;
+    workers[i].split = 0;
+    workers[i].count = 0;
+  }
+
+  // The gray stack is handed over, all of it shared
+  mark_worker_t *self = &workers[0];
+  self->items = g_vm.gray_stack;
+  self->capacity = g_vm.gray_capacity;
+  self->count = self->split = g_vm.gray_count;
+  g_vm.gray_stack = NULL;
+  g_vm.gray_capacity = 0;
+  g_vm.gray_count = 0;
+
+  for(int i = 1; i < worker_count; i++) {
+    if(pthread_create(&workers[i].thread, NULL, mark_worker, &workers[i]) != 0) {
+      // Carry on with the threads we've got: none of them can be done while this one isn't idle
+      __atomic_store_n(&worker_count, i, __ATOMIC_SEQ_CST);
+      break;
+    }
+  }
+  mark_worker(self);
+  for(int i = 1; i < worker_count; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  // Keep one buffer as the gray stack, for the next collections
+  g_vm.gray_stack = self->items;
+  g_vm.gray_capacity = self->capacity;
+  for(int i = 0; i < g_vm.gc_threads; i++) {
+    if(i > 0) {
+      free(workers[i].items);
+    }
+    pthread_mutex_destroy(&workers[i].lock);
+  }
+  workers = NULL;
+}
+#endif
+
+// Traces the heap of a major collection
+static void trace_major()
+{
+#ifdef PARALLEL_MARK
+  if(g_vm.gc_threads > 1) {
+    trace_parallel();
+    return;
+  }
+#endif
+  trace_references();
+}
+
+// Frees an object found unreachable, counting it in the record of the collection if any
+static void free_garbage(obj_t *object, gc_cycle_t *cycle)
+{
+  if(cycle != NULL) {
+    cycle->freed[object->type]++;
+  }
+  free_object(object);
+}
+
+static void sweep_nursery(gc_cycle_t *cycle)
+{
+  // Survivors are promoted: they keep their mark and move to the old generation.
+  obj_t *object = g_vm.young_objects;
   while(object != NULL) {
+    obj_t *next = object->next;
     if(object->is_marked) {
-      // Set it white for the next cycle
-      object->is_marked = false;
-      previous = object;
-      object = object->next;
+      object->next = g_vm.objects;
+      g_vm.objects = object;
     }
     else {
-      obj_t *unreached = object;
-      object = object->next;
-      // Unlink it
-      if(previous != NULL) {
-        previous->next = object;
-      }
-      else {
-        g_vm.objects = object;
+      // Only young strings can die here, so they leave the interned ones one by one rather than
+      // by a scan of the whole table
+      if(object->type == OBJ_STRING) {
+        table_delete(&g_vm.strings, (obj_string_t *)object);
       }
-      free_object(unreached);
+      free_garbage(object, cycle);
     }
+    object = next;
   }
+  g_vm.young_objects = NULL;
+  g_vm.young_tail = NULL;
+  g_vm.nursery_bytes = 0;
 }
 
-void collect_garbage()
+// Starts sweeping once the marking is over.
+static void reclaim_garbage()
+{
+  forget_remembered();
+  // Remove white strings from the set of interned strings,
+  // since they are not considered roots
+  table_remove_white(&g_vm.strings);
+
+  // The marked young objects are promoted and the white ones are garbage, as in the old list, so
+  // the whole nursery joins it to be swept along
+  if(g_vm.young_objects != NULL) {
+    g_vm.young_tail->next = g_vm.objects;
+    g_vm.objects = g_vm.young_objects;
+    g_vm.young_objects = NULL;
+    g_vm.young_tail = NULL;
+  }
+  g_vm.nursery_bytes = 0;
+
+  g_vm.gc_phase = GC_SWEEPING;
+  g_vm.gc_sweep = &g_vm.objects;
+}
+
+void collect_nursery()
 {
 #ifdef DEBUG_LOG_GC
-  printf("-- gc begin\n");
+  printf("-- minor gc begin\n");
   size_t before = g_vm.bytes_allocated;
 #endif
+  double start = now_us();
+  gc_cycle_t *cycle = gc_cycle_begin(GC_MINOR);
 
+  // Old objects are already marked, so only young ones get traced
   mark_roots();
+  for(int i = 0; i < g_vm.remembered_count; i++) {
+    blacken_object(g_vm.remembered[i]);
+  }
   trace_references();
-  // Remove white strings from the set of interned strings,
-  // since they are not considered roots
-  table_remove_white(&g_vm.strings);
-  sweep();
+  // Every young survivor becomes old, so no old object points to a young one anymore
+  forget_remembered();
+  double swept = now_us();
+  sweep_nursery(cycle);
 
-  // Adjust the threshold for the next collection
-  g_vm.next_gc = g_vm.bytes_allocated * GC_HEAP_GROWTH_FACTOR;
+  if(cycle != NULL) {
+    cycle->mark_us = swept - start;
+    cycle->sweep_us = now_us() - swept;
+    gc_cycle_end(cycle);
+  }
+  gc_record_pause(GC_PAUSE_MINOR, start);
+#ifdef DEBUG_LOG_GC
+  printf("-- minor gc end\n");
+  printf("   collected %zu bytes (from %zu to %zu)\n", before - g_vm.bytes_allocated, before,
+         g_vm.bytes_allocated);
+#endif
+}
 
+void collect_garbage()
+{
+#ifdef DEBUG_LOG_GC
+  printf("-- gc begin\n");
+#endif
+  double start = now_us();
+
+  // The unswept white objects would be indistinguishable from the live ones once marks are cleared
+  if(g_vm.gc_phase == GC_SWEEPING) {
+    sweep(false);
+  }
+  double marking = now_us();
+  gc_cycle_t *cycle = gc_cycle_begin(GC_MAJOR);
+
+  // A full collection traces the old objects too, so it starts by clearing their marks. This also
+  // abandons an incremental cycle in progress.
+  for(obj_t *object = g_vm.objects; object != NULL; object = object->next) {
+    object->is_marked = false;
+  }
+  if(g_vm.gc_phase == GC_MARKING) {
+    // The abandoned cycle may have marked young objects too, without tracing their children
+    for(obj_t *object = g_vm.young_objects; object != NULL; object = object->next) {
+      object->is_marked = false;
+    }
+  }
+  forget_remembered();
+  g_vm.gray_count = 0;
+  g_vm.gc_phase = GC_IDLE;
+
+  mark_roots();
+  trace_major();
+  reclaim_garbage();
+
+  if(cycle != NULL) {
+    cycle->mark_us += now_us() - marking;
+  }
+  gc_record_pause(GC_PAUSE_MAJOR, start);
 #ifdef DEBUG_LOG_GC
   printf("-- gc end\n");
-  printf("   collected %zu bytes (from %zu to %zu) next at %zu\n", before - g_vm.bytes_allocated,
-         before, g_vm.bytes_allocated, g_vm.next_gc);
 #endif
-}
\ No newline at end of file
+}
+
+static void start_cycle()
+{
+#ifdef DEBUG_LOG_GC
+  printf("-- incremental gc begin\n");
+#endif
+  gc_cycle_begin(GC_INCREMENTAL);
+  g_vm.gc_phase = GC_CLEARING;
+  g_vm.gc_cursor = g_vm.objects;
+}
+
+// The last step of a cycle, which began at `start`
+static void finish_cycle(double start)
+{
+  // Stores into the roots have no barrier, so they may hold white objects by now
+  mark_roots();
+  trace_major();
+  reclaim_garbage();
+
+  gc_cycle_t *cycle = gc_major_cycle();
+  if(cycle != NULL) {
+    cycle->mark_us += now_us() - start;
+  }
+  gc_record_pause(GC_PAUSE_MAJOR, start);
+#ifdef DEBUG_LOG_GC
+  printf("-- incremental gc end\n");
+#endif
+}
+
+// A step does a bounded amount of work, either a number of objects or a time slice. The clock is
+// only read every few objects, since reading it costs about as much as blackening one.
+static bool step_over(int work, double start)
+{
+  if(g_vm.gc_step_us > 0) {
+    return work % 16 == 0 && now_us() - start >= g_vm.gc_step_us;
+  }
+  return work >= g_vm.gc_step_objects;
+}
+
+static void record_step(double start)
+{
+  gc_cycle_t *cycle = gc_major_cycle();
+  if(cycle != NULL) {
+    cycle->mark_us += now_us() - start;
+  }
+  gc_record_pause(GC_PAUSE_STEP, start);
+}
+
+static void gc_step()
+{
+  double start = now_us();
+  int work = 0;
+
+  if(g_vm.gc_phase == GC_CLEARING) {
+    // No object is promoted during a cycle, so the old list stays the same under the cursor
+    while(g_vm.gc_cursor != NULL && !step_over(work++, start)) {
+      g_vm.gc_cursor->is_marked = false;
+      g_vm.gc_cursor = g_vm.gc_cursor->next;
+    }
+    if(g_vm.gc_cursor != NULL) {
+      record_step(start);
+      return;
+    }
+    // The remembered objects were recorded for minor collections, but now the whole heap is traced
+    forget_remembered();
+    mark_roots();
+    g_vm.gc_phase = GC_MARKING;
+  }
+
+  while(!step_over(work++, start)) {
+    if(g_vm.remembered_count > 0) {
+      obj_t *object = g_vm.remembered[--g_vm.remembered_count];
+      object->is_remembered = false;
+      blacken_object(object);
+    }
+    else if(g_vm.gray_count > 0) {
+      blacken_object(g_vm.gray_stack[--g_vm.gray_count]);
+    }
+    else {
+      finish_cycle(start);
+      return;
+    }
+  }
+
+  record_step(start);
+}
+
+// Threshold of the next major collection, from the heap that survived the last one
+static size_t next_threshold()
+{
+  double live = (double)g_vm.bytes_allocated;
+  double next = live * g_vm.gc_growth;
+  if(g_vm.gc_soft_limit > 0 && next > (double)g_vm.gc_soft_limit) {
+    // Collect more often rather than let the heap go far past the soft limit
+    double slow = live * GC_SOFT_GROWTH_FACTOR;
+    double limit = slow > (double)g_vm.gc_soft_limit ? slow : (double)g_vm.gc_soft_limit;
+    if(next > limit) {
+      next = limit;
+    }
+  }
+  if(next < (double)g_vm.gc_min_heap) {
+    next = (double)g_vm.gc_min_heap;
+  }
+  if(g_vm.gc_max_heap > 0 && next > (double)g_vm.gc_max_heap) {
+    next = (double)g_vm.gc_max_heap;
+  }
+  return (size_t)next;
+}
+
+// Frees the white objects of the old list from where the last call stopped, within the budget of a
+// step if bounded. Survivors stay marked: they are old. Objects promoted meanwhile are pushed in
+// front of the list, which has already been swept.
+static void sweep(bool bounded)
+{
+#ifdef DEBUG_LOG_GC
+  size_t before = g_vm.bytes_allocated;
+#endif
+  double start = now_us();
+  int work = 0;
+  gc_cycle_t *cycle = gc_major_cycle();
+
+  obj_t **link = g_vm.gc_sweep;
+  while(*link != NULL && !(bounded && step_over(work++, start))) {
+    obj_t *object = *link;
+    if(object->is_marked) {
+      link = &object->next;
+    }
+    else {
+      // Unlink it
+      *link = object->next;
+      free_garbage(object, cycle);
+    }
+  }
+  g_vm.gc_sweep = link;
+
+  if(*link == NULL) {
+    g_vm.gc_phase = GC_IDLE;
+#ifdef POOL_ALLOCATOR
+    pool_release_empty_pages();
+    if(g_vm.gc_compact > 0 && pool_fragmentation() > g_vm.gc_compact) {
+      g_vm.compact_pending = true;
+    }
+#endif
+    // Adjust the threshold for the next collection
+    g_vm.next_gc = next_threshold();
+  }
+
+  if(cycle != NULL) {
+    cycle->sweep_us += now_us() - start;
+    if(*link == NULL) {
+      gc_cycle_end(cycle);
+    }
+  }
+  if(bounded) {
+    gc_record_pause(GC_PAUSE_STEP, start);
+  }
+#ifdef DEBUG_LOG_GC
+  printf("-- sweep step: collected %zu bytes (from %zu to %zu)\n", before - g_vm.bytes_allocated,
+         before, g_vm.bytes_allocated);
+  if(*link == NULL) {
+    printf("-- sweep end: next at %zu\n", g_vm.next_gc);
+  }
+#endif
+}
+
+// Past the hard limit, a full collection swept on the spot is the last resort. If the heap is still
+// too big, run() raises an out of memory error at its next safe point; the allocations until then
+// go through, so that no instruction is left halfway.
+static void enforce_heap_limit()
+{
+  if(g_vm.heap_exhausted) {
+    return;
+  }
+  collect_garbage();
+  sweep(false);
+  if(g_vm.bytes_allocated > g_vm.gc_max_heap) {
+    g_vm.heap_exhausted = true;
+  }
+}
+
+#ifdef POOL_ALLOCATOR
+/* Compaction moves the objects out of the sparse pages of the pools, then fixes every reference to
+them. A moved object keeps the address of its copy in its next field until the references are
+fixed: the object lists are relinked to the copies as they are moved, so the field is free by then.
+Blocks owned by a single object, like arrays, are moved when their owner is fixed. The code arrays
+of functions stay put, since the frames point into them. */
+
+static bool is_evacuating(void *block, size_t size)
+{
+  return block != NULL && size > 0 && size <= POOL_MAX_SIZE && pool_is_evacuating(block);
+}
+
+static void *move_block(void *block, size_t size)
+{
+  if(!is_evacuating(block, size)) {
+    return block;
+  }
+  void *copy = pool_alloc(size);
+  memcpy(copy, block, size);
+  pool_free(block, size);
+  return copy;
+}
+
+static obj_t *move_object(obj_t *object)
+{
+  size_t size = object_size(object);
+  if(!is_evacuating(object, size)) {
+    return object;
+  }
+  obj_t *copy = (obj_t *)pool_alloc(size);
+  memcpy(copy, object, size);
+
+  // Pointers into the object itself
+  if(object->type == OBJ_UPVALUE) {
+    obj_upvalue_t *upvalue = (obj_upvalue_t *)object;
+    if(upvalue->location == &upvalue->closed) {
+      ((obj_upvalue_t *)copy)->location = &((obj_upvalue_t *)copy)->closed;
+    }
+  }
+  else if(object->type == OBJ_INSTANCE) {
+    obj_instance_t *instance = (obj_instance_t *)object;
+    if(instance->fields == instance->inline_fields) {
+      ((obj_instance_t *)copy)->fields = ((obj_instance_t *)copy)->inline_fields;
+    }
+  }
+
+  object->is_forwarded = true;
+  object->next = copy;
+  // The old blocks are freed once nothing points to them, the gray stack keeps track of them
+  if(g_vm.gray_capacity < g_vm.gray_count + 1) {
+    g_vm.gray_capacity = GROW_CAPACITY(g_vm.gray_capacity);
+    g_vm.gray_stack = (obj_t **)realloc(g_vm.gray_stack, sizeof(obj_t *) * g_vm.gray_capacity);
+    if(g_vm.gray_stack == NULL) {
+      exit(1);
+    }
+  }
+  g_vm.gray_stack[g_vm.gray_count++] = object;
+  return copy;
+}
+
+static void move_list(obj_t **list)
+{
+  for(obj_t **link = list; *link != NULL; link = &(*link)->next) {
+    *link = move_object(*link);
+  }
+}
+
+static void *forward(void *object)
+{
+  obj_t *moved = (obj_t *)object;
+  return moved != NULL && moved->is_forwarded ? moved->next : object;
+}
+
+static void forward_value(value_t *value)
+{
+  if(IS_OBJ(*value)) {
+    *value = OBJ_VAL((obj_t *)forward(AS_OBJ(*value)));
+  }
+}
+
+static void forward_array(value_array_t *array)
+{
+  array->values = move_block(array->values, sizeof(value_t) * array->capacity);
+  for(int i = 0; i < array->count; i++) {
+    forward_value(&array->values[i]);
+  }
+}
+
+static void forward_table(table_t *table)
+{
+  table->entries = move_block(table->entries, sizeof(entry_t) * table->capacity);
+  for(int i = 0; i < table->capacity; i++) {
+    table->entries[i].key = forward(table->entries[i].key);
+    forward_value(&table->entries[i].value);
+  }
+}
+
+static void forward_chunk(chunk_t *chunk)
+{
+  chunk->lines = move_block(chunk->lines, sizeof(int) * chunk->capacity);
+  forward_array(&chunk->constants);
+  chunk->caches = move_block(chunk->caches, sizeof(inline_cache_t) * chunk->cache_capacity);
+  for(int i = 0; i < chunk->cache_count; i++) {
+    inline_cache_t *cache = &chunk->caches[i];
+    for(int j = 0; j < cache->count; j++) {
+      cache->entries[j].shape = forward(cache->entries[j].shape);
+      cache->entries[j].method = forward(cache->entries[j].method);
+      cache->entries[j].transition = forward(cache->entries[j].transition);
+    }
+  }
+}
+
+// Like blacken_object(), but updates the references instead of marking them
+static void forward_references(obj_t *object)
+{
+  switch(object->type) {
+  case OBJ_BOUND_METHOD: {
+    obj_bound_method_t *bound_method = (obj_bound_method_t *)object;
+    forward_value(&bound_method->receiver);
+    bound_method->method = forward(bound_method->method);
+    break;
+  }
+
+  case OBJ_CLASS: {
+    obj_class_t *klass = (obj_class_t *)object;
+    klass->name = forward(klass->name);
+    forward_table(&klass->methods);
+    klass->shape = forward(klass->shape);
+    break;
+  }
+
+  case OBJ_INSTANCE: {
+    obj_instance_t *instance = (obj_instance_t *)object;
+    instance->klass = forward(instance->klass);
+    instance->shape = forward(instance->shape);
+    if(instance->fields != instance->inline_fields) {
+      instance->fields = move_block(instance->fields, sizeof(value_t) * instance->capacity);
+    }
+    for(int i = 0; i < instance->shape->field_count; i++) {
+      forward_value(&instance->fields[i]);
+    }
+    break;
+  }
+
+  case OBJ_SHAPE: {
+    // A slots table shared along a chain of shapes is fixed by its owner. Its keys are the names
+    // of the fields, its values are numbers.
+    obj_shape_t *shape = (obj_shape_t *)object;
+    shape->parent = forward(shape->parent);
+    shape->name = forward(shape->name);
+    forward_table(&shape->transitions);
+    if(shape->owns_slots) {
+      forward_table(shape->slots);
+    }
+    break;
+  }
+
+  case OBJ_CLOSURE: {
+    obj_closure_t *closure = (obj_closure_t *)object;
+    closure->function = forward(closure->function);
+    closure->upvalues =
+        move_block(closure->upvalues, sizeof(obj_upvalue_t *) * closure->upvalue_count);
+    for(int i = 0; i < closure->upvalue_count; i++) {
+      closure->upvalues[i] = forward(closure->upvalues[i]);
+    }
+    break;
+  }
+
+  case OBJ_FUNCTION: {
+    obj_function_t *function = (obj_function_t *)object;
+    function->name = forward(function->name);
+    forward_chunk(&function->chunk);
+    break;
+  }
+
+  case OBJ_UPVALUE: {
+    obj_upvalue_t *upvalue = (obj_upvalue_t *)object;
+    forward_value(&upvalue->closed);
+    upvalue->next = forward(upvalue->next);
+    break;
+  }
+
+  case OBJ_NATIVE:
+  case OBJ_STRING: {
+    break;
+  }
+  }
+}
+
+static void forward_roots()
+{
+  for(value_t *slot = g_vm.stack; slot < g_vm.stack_top; slot++) {
+    forward_value(slot);
+  }
+  for(int i = 0; i < g_vm.frame_count; i++) {
+    g_vm.frames[i].closure = forward(g_vm.frames[i].closure);
+  }
+  g_vm.open_upvalues = forward(g_vm.open_upvalues);
+
+  forward_table(&g_vm.global_slots);
+  forward_array(&g_vm.global_names);
+  forward_array(&g_vm.global_values);
+  forward_table(&g_vm.strings);
+  g_vm.init_string = forward(g_vm.init_string);
+
+  for(int i = 0; i < g_vm.remembered_count; i++) {
+    g_vm.remembered[i] = forward(g_vm.remembered[i]);
+  }
+  g_vm.young_tail = forward(g_vm.young_tail);
+}
+
+void compact_heap()
+{
+  // The phases of a collection keep pointers to objects of their own
+  if(g_vm.gc_phase != GC_IDLE) {
+    return;
+  }
+  g_vm.compact_pending = false;
+
+#ifdef DEBUG_LOG_GC
+  printf("-- compaction begin: %.0f%% of the pools free\n", pool_fragmentation() * 100);
+#endif
+  double start = now_us();
+
+  pool_begin_evacuation();
+  move_list(&g_vm.objects);
+  move_list(&g_vm.young_objects);
+
+  for(obj_t *object = g_vm.objects; object != NULL; object = object->next) {
+    forward_references(object);
+  }
+  for(obj_t *object = g_vm.young_objects; object != NULL; object = object->next) {
+    forward_references(object);
+  }
+  forward_roots();
+
+  while(g_vm.gray_count > 0) {
+    obj_t *object = g_vm.gray_stack[--g_vm.gray_count];
+    pool_free(object, object_size(object));
+  }
+  pool_end_evacuation();
+
+  gc_record_pause(GC_PAUSE_MAJOR, start);
+#ifdef DEBUG_LOG_GC
+  printf("-- compaction end: %.0f%% of the pools free\n", pool_fragmentation() * 100);
+#endif
+}
+#endif
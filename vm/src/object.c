@@ -13,10 +13,15 @@ static obj_t *allocate_obj(size_t size, obj_type_t type)
   obj_t *object = (obj_t *)reallocate(NULL, 0, size);
   object->type = type;
   object->is_marked = false;
+  object->is_remembered = false;
+  object->is_forwarded = false;
 
-  // link into VM object list
-  object->next = g_vm.objects;
-  g_vm.objects = object;
+  // link into the nursery
+  if(g_vm.young_objects == NULL) {
+    g_vm.young_tail = object;
+  }
+  object->next = g_vm.young_objects;
+  g_vm.young_objects = object;
 
 #ifdef DEBUG_LOG_GC
   printf("%p allocate %zu for %d\n", object, size, type);
@@ -80,9 +85,17 @@ obj_function_t *new_function()
 
 obj_instance_t *new_instance(obj_class_t *klass)
 {
-  obj_instance_t *instance = ALLOCATE_OBJ(obj_instance_t, OBJ_INSTANCE);
+  // Reserve inline room for as many fields as the instances of the class had so far, within
+  // INLINE_FIELDS_MAX: instances of the same class usually end up with the same fields, so most
+  // never need a separate array.
+  int inline_count = klass->field_count;
+  obj_instance_t *instance = (obj_instance_t *)allocate_obj(
+      sizeof(obj_instance_t) + sizeof(value_t) * inline_count, OBJ_INSTANCE);
   instance->klass = klass;
-  init_table(&instance->fields);
+  instance->shape = klass->shape;
+  instance->fields = instance->inline_fields;
+  instance->capacity = inline_count;
+  instance->inline_count = inline_count;
   return instance;
 }
 
@@ -91,9 +104,29 @@ obj_class_t *new_class(obj_string_t *name)
   obj_class_t *klass = ALLOCATE_OBJ(obj_class_t, OBJ_CLASS);
   klass->name = name;
   init_table(&klass->methods);
+  klass->shape = NULL;
+  klass->field_count = 0;
+
+  // The root shape can trigger a GC, keep the class reachable.
+  push(OBJ_VAL(klass));
+  klass->shape = new_shape(NULL, NULL);
+  write_barrier(&klass->base, OBJ_VAL(klass->shape));
+  pop();
   return klass;
 }
 
+obj_shape_t *new_shape(obj_shape_t *parent, obj_string_t *name)
+{
+  obj_shape_t *shape = ALLOCATE_OBJ(obj_shape_t, OBJ_SHAPE);
+  shape->parent = parent;
+  shape->name = name;
+  shape->field_count = parent == NULL ? 0 : parent->field_count + 1;
+  shape->slots = NULL;
+  shape->owns_slots = false;
+  init_table(&shape->transitions);
+  return shape;
+}
+
 obj_string_t *copy_string(const char *chars, int length)
 {
   uint32_t hash = hash_string(chars, length);
@@ -183,6 +216,12 @@ void print_object(value_t value)
     break;
   }
 
+  case OBJ_SHAPE: {
+    // Like upvalues, shapes are never exposed to the user
+    printf("shape");
+    break;
+  }
+
   case OBJ_UPVALUE: {
     // This gets never called by the runtime, only for compiler warning
     printf("upvalue");
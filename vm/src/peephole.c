@@ -0,0 +1,159 @@
+#include <memory.h>
+#include <object.h>
+#include <peephole.h>
+#include <string.h>
+
+/* Peephole pass, run on every function once the compiler is done with it.
+
+Short sequences that dominate the opcode pair counts of loops (see DEBUG_OPCODE_PAIRS) are fused
+into superinstructions, which do the same work with a single dispatch:
+
+  GET_LOCAL a; GET_LOCAL b; ADD                       -> ADD_LOCALS a b
+  CONSTANT k; ADD                                     -> ADD_CONSTANT k
+  GET_LOCAL a; CONSTANT k; LESS; JUMP_IF_FALSE; POP   -> LESS_JUMP a k
+  GET_LOCAL a; CONSTANT k; ADD; SET_LOCAL a; POP      -> INC_LOCAL a k
+  SET_LOCAL a; POP                                    -> SET_LOCAL_POP a
+
+Only the first instruction of a sequence may be a jump target, anything else would jump into the
+middle of a superinstruction. The code shrinks in place, then the jump offsets are recomputed. */
+
+static bool is_number_constant(chunk_t *chunk, int offset)
+{
+  return IS_NUMBER(chunk->constants.values[chunk->code[offset + 1]]);
+}
+
+/* Checks that the code at `offset` is the given sequence of opcodes, and that only its first
+instruction is a jump target. On success, `at` holds the offset of each instruction. */
+static bool match(chunk_t *chunk, const bool *targets, int offset, const uint8_t *opcodes, int count,
+                  int *at)
+{
+  for(int i = 0; i < count; i++) {
+    if(offset >= chunk->count || chunk->code[offset] != opcodes[i] || (i > 0 && targets[offset])) {
+      return false;
+    }
+    at[i] = offset;
+    offset += instruction_length(chunk, offset);
+  }
+  return true;
+}
+
+void optimize_chunk(chunk_t *chunk)
+{
+  int count = chunk->count;
+  // Indexed by old offsets, one past the end for jumps to the end of the code
+  bool *targets = ALLOCATE(bool, count + 1);
+  int *offsets = ALLOCATE(int, count + 1);
+  // Old target of the jump written at each new offset, -1 for other instructions
+  int *jumps = ALLOCATE(int, count);
+  memset(targets, 0, sizeof(bool) * (count + 1));
+
+  for(int offset = 0; offset < count; offset += instruction_length(chunk, offset)) {
+    if(is_jump(chunk->code[offset])) {
+      int target = jump_target(chunk, offset);
+      targets[target] = true;
+      if(chunk->code[offset] == OP_JUMP_IF_FALSE && target < count && chunk->code[target] == OP_POP) {
+        targets[target + 1] = true; // Where LESS_JUMP goes instead, see below
+      }
+    }
+  }
+
+  static const uint8_t inc_local[] = {OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP};
+  static const uint8_t less_jump[] = {OP_GET_LOCAL, OP_CONSTANT, OP_LESS, OP_JUMP_IF_FALSE, OP_POP};
+  static const uint8_t add_locals[] = {OP_GET_LOCAL, OP_GET_LOCAL, OP_ADD};
+  static const uint8_t add_constant[] = {OP_CONSTANT, OP_ADD};
+  static const uint8_t set_local_pop[] = {OP_SET_LOCAL, OP_POP};
+
+  uint8_t *code = chunk->code;
+  int *lines = chunk->lines;
+  int read = 0;
+  int write = 0;
+  while(read < count) {
+    int at[5];
+    uint8_t fused[5];
+    int length = 0;
+    int line = lines[read]; // Line of the instruction that can raise an error
+    int next;               // Old offset of the instruction following the sequence
+    int target = -1;
+
+    if(match(chunk, targets, read, inc_local, 5, at) && code[at[0] + 1] == code[at[3] + 1]
+       && is_number_constant(chunk, at[1])) {
+      fused[length++] = OP_INC_LOCAL;
+      fused[length++] = code[at[0] + 1];
+      fused[length++] = code[at[1] + 1];
+      line = lines[at[2]];
+      next = at[4] + 1;
+    }
+    else if(match(chunk, targets, read, less_jump, 5, at)
+            && code[jump_target(chunk, at[3])] == OP_POP) {
+      /* When the condition is false JUMP_IF_FALSE lands on the POP of the else branch or the loop
+      exit, which only drops the condition. Since the superinstruction never pushes it, it jumps
+      right after that POP. */
+      fused[length++] = OP_LESS_JUMP;
+      fused[length++] = code[at[0] + 1];
+      fused[length++] = code[at[1] + 1];
+      fused[length++] = 0xff;
+      fused[length++] = 0xff;
+      line = lines[at[2]];
+      next = at[4] + 1;
+      target = jump_target(chunk, at[3]) + 1;
+    }
+    else if(match(chunk, targets, read, add_locals, 3, at)) {
+      fused[length++] = OP_ADD_LOCALS;
+      fused[length++] = code[at[0] + 1];
+      fused[length++] = code[at[1] + 1];
+      line = lines[at[2]];
+      next = at[2] + 1;
+    }
+    else if(match(chunk, targets, read, add_constant, 2, at) && is_number_constant(chunk, at[0])) {
+      fused[length++] = OP_ADD_CONSTANT;
+      fused[length++] = code[at[0] + 1];
+      line = lines[at[1]];
+      next = at[1] + 1;
+    }
+    else if(match(chunk, targets, read, set_local_pop, 2, at)) {
+      fused[length++] = OP_SET_LOCAL_POP;
+      fused[length++] = code[at[0] + 1];
+      next = at[1] + 1;
+    }
+    else {
+      // Copied as is. The code only shrinks, so the write never overtakes the read.
+      next = read + instruction_length(chunk, read);
+      offsets[read] = write;
+      jumps[write] = is_jump(code[read]) ? jump_target(chunk, read) : -1;
+      for(int i = read; i < next; i++) {
+        code[write] = code[i];
+        lines[write++] = lines[i];
+      }
+      read = next;
+      continue;
+    }
+
+    for(int i = read; i < next; i++) {
+      offsets[i] = write;
+    }
+    jumps[write] = target;
+    for(int i = 0; i < length; i++) {
+      code[write] = fused[i];
+      lines[write++] = line;
+    }
+    read = next;
+  }
+  offsets[count] = write;
+  chunk->count = write;
+
+  // Every jump now spans fewer bytes than before, so the offsets still fit in 16 bits
+  for(int offset = 0; offset < write; offset += instruction_length(chunk, offset)) {
+    if(jumps[offset] == -1) {
+      continue;
+    }
+    int after = offset + instruction_length(chunk, offset);
+    int jump = code[offset] == OP_LOOP ? after - offsets[jumps[offset]]
+                                       : offsets[jumps[offset]] - after;
+    code[after - 2] = (jump >> 8) & 0xff;
+    code[after - 1] = jump & 0xff;
+  }
+
+  FREE_ARRAY(bool, targets, count + 1);
+  FREE_ARRAY(int, offsets, count + 1);
+  FREE_ARRAY(int, jumps, count);
+}
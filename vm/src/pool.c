@@ -0,0 +1,231 @@
+#include <pool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_EMPTY_PAGES_KEPT 1 // Per size class, so that a class in use doesn't keep paying for pages
+#define POOL_COMPACT_MIN_PAGES 16 // Smaller pools aren't worth compacting
+
+/* A page starts with this header, and the blocks follow. Pages are aligned to their size, so the
+page of a block is found by masking its address.
+The blocks freed in a page go on its own free list: a page whose blocks are all free can be given
+back, which the collector does once a sweep is over. Blocks past `unused` have never been handed
+out, so a new page needs no list to be built. */
+typedef struct pool_block {
+  struct pool_block *next;
+} pool_block_t;
+
+typedef struct pool_page {
+  // Pages of a size class with at least one free block
+  struct pool_page *prev;
+  struct pool_page *next;
+  pool_block_t *free;
+  char *unused;
+  int size_class;
+  int live; // Blocks in use
+  bool evacuating;
+} pool_page_t;
+
+#define PAGE_OF(pointer) ((pool_page_t *)((uintptr_t)(pointer) & ~(uintptr_t)(POOL_PAGE_SIZE - 1)))
+#define PAGE_HEADER_SIZE ((sizeof(pool_page_t) + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE)
+#define PAGE_BLOCKS(page) ((char *)(page) + PAGE_HEADER_SIZE)
+#define BLOCK_SIZE(size_class) (((size_class) + 1) * POOL_GRANULE)
+#define PAGE_CAPACITY(size_class) ((int)((POOL_PAGE_SIZE - PAGE_HEADER_SIZE) / BLOCK_SIZE(size_class)))
+
+typedef struct {
+  pool_page_t *available; // Pages with free blocks, the most recently freed into first
+  pool_page_t *full;      // Only linked to free them all at the end
+  int page_count;
+} size_class_t;
+
+static size_class_t g_classes[POOL_CLASSES];
+static pool_page_t *g_evacuating; // Pages being emptied by a compaction
+
+static void unlink_page(pool_page_t **list, pool_page_t *page)
+{
+  if(page->prev != NULL) {
+    page->prev->next = page->next;
+  }
+  else {
+    *list = page->next;
+  }
+  if(page->next != NULL) {
+    page->next->prev = page->prev;
+  }
+}
+
+static void link_page(pool_page_t **list, pool_page_t *page)
+{
+  page->prev = NULL;
+  page->next = *list;
+  if(*list != NULL) {
+    (*list)->prev = page;
+  }
+  *list = page;
+}
+
+static bool is_full(pool_page_t *page)
+{
+  return page->free == NULL &&
+         page->unused + BLOCK_SIZE(page->size_class) > (char *)page + POOL_PAGE_SIZE;
+}
+
+static pool_page_t *new_page(int size_class)
+{
+  pool_page_t *page = (pool_page_t *)aligned_alloc(POOL_PAGE_SIZE, POOL_PAGE_SIZE);
+  if(page == NULL) {
+    exit(1);
+  }
+  page->free = NULL;
+  page->unused = PAGE_BLOCKS(page);
+  page->size_class = size_class;
+  page->live = 0;
+  page->evacuating = false;
+  link_page(&g_classes[size_class].available, page);
+  g_classes[size_class].page_count++;
+  return page;
+}
+
+void *pool_alloc(size_t size)
+{
+  int size_class = POOL_CLASS(size);
+  size_class_t *pool = &g_classes[size_class];
+  pool_page_t *page = pool->available;
+  if(page == NULL) {
+    page = new_page(size_class);
+  }
+
+  void *block;
+  if(page->free != NULL) {
+    block = page->free;
+    page->free = page->free->next;
+  }
+  else {
+    block = page->unused;
+    page->unused += BLOCK_SIZE(size_class);
+  }
+  page->live++;
+
+  if(is_full(page)) {
+    unlink_page(&pool->available, page);
+    link_page(&pool->full, page);
+  }
+  return block;
+}
+
+void pool_free(void *pointer, size_t size)
+{
+  pool_page_t *page = PAGE_OF(pointer);
+  size_class_t *pool = &g_classes[POOL_CLASS(size)];
+  // An evacuated page is on none of the lists until the compaction is over
+  if(!page->evacuating && is_full(page)) {
+    unlink_page(&pool->full, page);
+    link_page(&pool->available, page);
+  }
+  pool_block_t *block = (pool_block_t *)pointer;
+  block->next = page->free;
+  page->free = block;
+  page->live--;
+}
+
+void pool_release_empty_pages()
+{
+  for(int i = 0; i < POOL_CLASSES; i++) {
+    int kept = 0;
+    pool_page_t *page = g_classes[i].available;
+    while(page != NULL) {
+      pool_page_t *next = page->next;
+      if(page->live == 0 && kept++ >= POOL_EMPTY_PAGES_KEPT) {
+        unlink_page(&g_classes[i].available, page);
+        g_classes[i].page_count--;
+        free(page);
+      }
+      page = next;
+    }
+  }
+}
+
+double pool_fragmentation()
+{
+  // Share of the blocks of all pages that are free, once there are enough pages for it to matter
+  long pages = 0;
+  long capacity = 0;
+  long live = 0;
+  for(int i = 0; i < POOL_CLASSES; i++) {
+    pool_page_t *lists[] = {g_classes[i].available, g_classes[i].full};
+    for(int j = 0; j < 2; j++) {
+      for(pool_page_t *page = lists[j]; page != NULL; page = page->next) {
+        pages++;
+        capacity += PAGE_CAPACITY(i);
+        live += page->live;
+      }
+    }
+  }
+  if(pages < POOL_COMPACT_MIN_PAGES) {
+    return 0;
+  }
+  return 1 - (double)live / capacity;
+}
+
+void pool_begin_evacuation()
+{
+  // Pages less than half full are emptied, unless they are the only page of their class
+  for(int i = 0; i < POOL_CLASSES; i++) {
+    if(g_classes[i].page_count < 2) {
+      continue;
+    }
+    pool_page_t *page = g_classes[i].available;
+    while(page != NULL) {
+      pool_page_t *next = page->next;
+      if(page->live * 2 < PAGE_CAPACITY(i)) {
+        unlink_page(&g_classes[i].available, page);
+        page->evacuating = true;
+        link_page(&g_evacuating, page);
+      }
+      page = next;
+    }
+  }
+}
+
+bool pool_is_evacuating(void *block)
+{
+  return PAGE_OF(block)->evacuating;
+}
+
+void pool_end_evacuation()
+{
+  // A page may still hold blocks that couldn't be moved: it goes back to its class
+  while(g_evacuating != NULL) {
+    pool_page_t *page = g_evacuating;
+    g_evacuating = page->next;
+    page->evacuating = false;
+    size_class_t *pool = &g_classes[page->size_class];
+    if(page->live == 0) {
+      pool->page_count--;
+      free(page);
+    }
+    else {
+      link_page(is_full(page) ? &pool->full : &pool->available, page);
+    }
+  }
+}
+
+static void free_page_list(pool_page_t *page)
+{
+  while(page != NULL) {
+    pool_page_t *next = page->next;
+    free(page);
+    page = next;
+  }
+}
+
+void free_pools()
+{
+  for(int i = 0; i < POOL_CLASSES; i++) {
+    free_page_list(g_classes[i].available);
+    free_page_list(g_classes[i].full);
+    g_classes[i].available = NULL;
+    g_classes[i].full = NULL;
+    g_classes[i].page_count = 0;
+  }
+}
@@ -0,0 +1,471 @@
+#include <memory.h>
+#include <registers.h>
+#include <string.h>
+
+/* Register backend (--registers).
+
+The compiler emits stack code, where `i = i + 1` pushes `i` and `1`, adds them, stores the sum and
+pops it: five dispatches and as many stack moves for one addition. This pass translates the stack
+code into 3-address instructions that read their operands straight from the frame and write their
+result into it:
+
+  GET_LOCAL i; CONSTANT 1; ADD; SET_LOCAL i; POP      -> REG_ADDK i = i, 1
+  GET_LOCAL i; GET_LOCAL n; LESS; JUMP_IF_FALSE; POP  -> REG_LESS_JUMP i, n
+
+The registers are the slots of the frame: the locals the compiler allocated, and above them the
+temporaries, which stay where the stack code puts them. The depth of the stack at each instruction
+is known, so an operand that stack code would pop is just the slot at the top, and each register
+instruction sets the top of the stack for the collector and the calls. Whatever has no register
+form is left as stack code.
+
+The pass simulates the stack once through the code. Reads of locals and constants are not emitted
+right away but kept pending on top of the real stack, until an instruction names them as operands.
+Before any other instruction, at jump targets, and before the slot a pending value would occupy is
+used as a local (`var i = 0;` leaves the 0 there), pending values are pushed for real. */
+
+#define MAX_PENDING UINT8_COUNT
+
+typedef struct {
+  uint8_t opcode; // OP_GET_LOCAL or OP_CONSTANT
+  uint8_t index;
+  int line;
+} pending_t;
+
+typedef struct {
+  chunk_t *chunk;
+  // The translated code
+  uint8_t *code;
+  int *lines;
+  int count;
+  int capacity;
+  // Jumps of the translated code, with the old offset they go to
+  int *jump_at;
+  int *jump_to;
+  int jump_count;
+  int jump_capacity;
+
+  int depth; // Slots of the frame on the real stack
+  pending_t pending[MAX_PENDING];
+  int pending_count;
+  int result; // Offset of the last instruction if it pushed its result, -1 otherwise
+} translator_t;
+
+static void emit(translator_t *t, uint8_t byte, int line)
+{
+  if(t->capacity < t->count + 1) {
+    int old_cap = t->capacity;
+    t->capacity = GROW_CAPACITY(old_cap);
+    t->code = GROW_ARRAY(uint8_t, t->code, old_cap, t->capacity);
+    t->lines = GROW_ARRAY(int, t->lines, old_cap, t->capacity);
+  }
+  t->code[t->count] = byte;
+  t->lines[t->count++] = line;
+}
+
+static void add_jump(translator_t *t, int target)
+{
+  if(t->jump_capacity < t->jump_count + 1) {
+    int old_cap = t->jump_capacity;
+    t->jump_capacity = GROW_CAPACITY(old_cap);
+    t->jump_at = GROW_ARRAY(int, t->jump_at, old_cap, t->jump_capacity);
+    t->jump_to = GROW_ARRAY(int, t->jump_to, old_cap, t->jump_capacity);
+  }
+  t->jump_at[t->jump_count] = t->count;
+  t->jump_to[t->jump_count++] = target;
+}
+
+// Pushes the deepest pending value for real
+static void materialize(translator_t *t)
+{
+  pending_t *value = &t->pending[0];
+  emit(t, value->opcode, value->line);
+  emit(t, value->index, value->line);
+  t->depth++;
+  t->pending_count--;
+  memmove(&t->pending[0], &t->pending[1], sizeof(pending_t) * t->pending_count);
+}
+
+static void flush(translator_t *t)
+{
+  while(t->pending_count > 0) {
+    materialize(t);
+  }
+}
+
+// Makes sure that no pending value stands for `slot` itself
+static void ensure_slot(translator_t *t, uint8_t slot)
+{
+  while(t->pending_count > 0 && t->depth <= slot) {
+    materialize(t);
+  }
+}
+
+// Before `slot` is written, the pending reads of its old value must be pushed
+static void flush_slot(translator_t *t, uint8_t slot)
+{
+  ensure_slot(t, slot);
+  int last = -1;
+  for(int i = 0; i < t->pending_count; i++) {
+    if(t->pending[i].opcode == OP_GET_LOCAL && t->pending[i].index == slot) {
+      last = i;
+    }
+  }
+  for(int i = 0; i <= last; i++) {
+    materialize(t);
+  }
+}
+
+static void defer(translator_t *t, uint8_t opcode, uint8_t index, int line)
+{
+  if(t->pending_count == MAX_PENDING) {
+    materialize(t);
+  }
+  t->pending[t->pending_count++] = (pending_t){opcode, index, line};
+}
+
+typedef struct {
+  bool constant;
+  uint8_t index;
+} operand_t;
+
+// Takes the operand on top of the stack. Only the last operand of an instruction can be a constant.
+static void take_operand(translator_t *t, bool constant, operand_t *operand)
+{
+  if(t->pending_count > 0) {
+    pending_t *value = &t->pending[t->pending_count - 1];
+    if(value->opcode == OP_GET_LOCAL || constant) {
+      t->pending_count--;
+      *operand = (operand_t){value->opcode == OP_CONSTANT, value->index};
+      return;
+    }
+    flush(t);
+  }
+  t->depth--;
+  *operand = (operand_t){false, t->depth};
+}
+
+// Whether the slots and the depth a register instruction may use still fit in a byte
+static bool fits(translator_t *t)
+{
+  return t->depth + t->pending_count < UINT8_MAX;
+}
+
+// Change of the stack depth after the stack instruction at `offset`
+static int stack_effect(chunk_t *chunk, int offset)
+{
+  switch(chunk->code[offset]) {
+  case OP_CONSTANT:
+  case OP_NIL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_GET_LOCAL:
+  case OP_GET_GLOBAL:
+  case OP_GET_UPVALUE:
+  case OP_GET_PROPERTY_PAIR:
+  case OP_GET_LOCAL_PAIR:
+  case OP_CLOSURE:
+  case OP_CLASS:
+    return 1;
+
+  case OP_POP:
+  case OP_DEFINE_GLOBAL:
+  case OP_SET_PROPERTY:
+  case OP_GET_SUPER:
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_PRINT:
+  case OP_CLOSE_UPVALUE:
+  case OP_RETURN:
+  case OP_INHERIT:
+  case OP_METHOD:
+    return -1;
+
+  case OP_CALL:
+  case OP_TAIL_CALL:
+  case OP_CALL_PAIR:
+    return -chunk->code[offset + 1]; // The callee slot gets the result
+  case OP_INVOKE:
+  case OP_TAIL_INVOKE:
+    return -chunk->code[offset + 2];
+  case OP_SUPER_INVOKE:
+    return -chunk->code[offset + 2] - 1; // The superclass is popped too
+
+  default:
+    return 0;
+  }
+}
+
+// Copies a stack instruction, with all the pending values pushed before it
+static void copy_instruction(translator_t *t, int offset, int *depths)
+{
+  chunk_t *chunk = t->chunk;
+  flush(t);
+  if(is_jump(chunk->code[offset])) {
+    add_jump(t, jump_target(chunk, offset));
+  }
+  int length = instruction_length(chunk, offset);
+  for(int i = 0; i < length; i++) {
+    emit(t, chunk->code[offset + i], chunk->lines[offset + i]);
+  }
+  t->depth += stack_effect(chunk, offset);
+  if(is_jump(chunk->code[offset]) && chunk->code[offset] != OP_LOOP) {
+    depths[jump_target(chunk, offset)] = t->depth;
+  }
+}
+
+static uint8_t register_opcode(uint8_t opcode)
+{
+  switch(opcode) {
+  case OP_ADD: return OP_REG_ADD;
+  case OP_SUBTRACT: return OP_REG_SUBTRACT;
+  case OP_MULTIPLY: return OP_REG_MULTIPLY;
+  case OP_DIVIDE: return OP_REG_DIVIDE;
+  case OP_EQUAL: return OP_REG_EQUAL;
+  case OP_GREATER: return OP_REG_GREATER;
+  default: return OP_REG_LESS;
+  }
+}
+
+static uint8_t compare_jump_opcode(uint8_t opcode)
+{
+  switch(opcode) {
+  case OP_EQUAL: return OP_REG_EQUAL_JUMP;
+  case OP_GREATER: return OP_REG_GREATER_JUMP;
+  default: return OP_REG_LESS_JUMP;
+  }
+}
+
+/* Translates a comparison feeding the condition of an if or a loop:
+
+  LESS; [NOT]; JUMP_IF_FALSE else; POP; ... else: POP
+
+The condition is never pushed, so the jump goes past the POP of the else branch. Returns the offset
+of the next instruction, or -1 when the code does not have that shape. */
+static int compare_jump(translator_t *t, int offset, const bool *targets, int *depths)
+{
+  chunk_t *chunk = t->chunk;
+  int jump = offset + 1;
+  bool negated = jump < chunk->count && chunk->code[jump] == OP_NOT && !targets[jump];
+  if(negated) {
+    jump++;
+  }
+  if(jump + 3 >= chunk->count || chunk->code[jump] != OP_JUMP_IF_FALSE || targets[jump]
+     || chunk->code[jump + 3] != OP_POP || targets[jump + 3]
+     || chunk->code[jump_target(chunk, jump)] != OP_POP) {
+    return -1;
+  }
+
+  operand_t b, c;
+  take_operand(t, true, &c);
+  take_operand(t, false, &b);
+  flush(t);
+  int line = chunk->lines[offset];
+  int target = jump_target(chunk, jump) + 1;
+  add_jump(t, target);
+  depths[target - 1] = t->depth + 1; // Left for other paths, if any
+  depths[target] = t->depth;
+  emit(t, compare_jump_opcode(chunk->code[offset]) + c.constant, line);
+  emit(t, t->depth, line);
+  emit(t, negated, line);
+  emit(t, b.index, line);
+  emit(t, c.index, line);
+  emit(t, 0xff, line);
+  emit(t, 0xff, line);
+  return jump + 4;
+}
+
+static void binary_operation(translator_t *t, int offset)
+{
+  operand_t b, c;
+  take_operand(t, true, &c);
+  take_operand(t, false, &b);
+  // The result goes on top, so every pending value below it must be there first
+  flush(t);
+  int line = t->chunk->lines[offset];
+  t->result = t->count;
+  emit(t, register_opcode(t->chunk->code[offset]) + c.constant, line);
+  emit(t, t->depth + 1, line);
+  emit(t, t->depth, line);
+  emit(t, b.index, line);
+  emit(t, c.index, line);
+  t->depth++;
+}
+
+// SET_LOCAL slot; POP, i.e. an assignment statement
+static void store_local(translator_t *t, uint8_t slot, int line)
+{
+  if(t->pending_count > 0) {
+    operand_t value;
+    take_operand(t, true, &value);
+    flush_slot(t, slot);
+    if(!value.constant && value.index == slot) {
+      return;
+    }
+    emit(t, value.constant ? OP_REG_LOADK : OP_REG_MOVE, line);
+    emit(t, t->depth, line);
+    emit(t, slot, line);
+    emit(t, value.index, line);
+    return;
+  }
+
+  t->depth--;
+  if(t->result != -1) {
+    // Store the result of the last instruction right away instead of pushing it
+    t->code[t->result + 1] = t->depth;
+    t->code[t->result + 2] = slot;
+    return;
+  }
+  emit(t, OP_REG_MOVE, line);
+  emit(t, t->depth, line);
+  emit(t, slot, line);
+  emit(t, t->depth, line);
+}
+
+static void free_translator(translator_t *t, int count, bool *targets, int *offsets, int *depths)
+{
+  FREE_ARRAY(int, t->jump_at, t->jump_capacity);
+  FREE_ARRAY(int, t->jump_to, t->jump_capacity);
+  FREE_ARRAY(bool, targets, count + 1);
+  FREE_ARRAY(int, offsets, count + 1);
+  FREE_ARRAY(int, depths, count + 1);
+}
+
+void translate_registers(obj_function_t *function)
+{
+  chunk_t *chunk = &function->chunk;
+  int count = chunk->count;
+  translator_t t = {.chunk = chunk, .result = -1};
+  // The callee, or the receiver of a method, is in slot zero
+  t.depth = function->arity + 1;
+
+  // Indexed by old offsets, one past the end for jumps to the end of the code
+  bool *targets = ALLOCATE(bool, count + 1);
+  int *offsets = ALLOCATE(int, count + 1);
+  int *depths = ALLOCATE(int, count + 1); // Stack depth at jump targets, -1 if unknown yet
+  memset(targets, 0, sizeof(bool) * (count + 1));
+  for(int i = 0; i <= count; i++) {
+    depths[i] = -1;
+  }
+  for(int offset = 0; offset < count; offset += instruction_length(chunk, offset)) {
+    if(is_jump(chunk->code[offset])) {
+      int target = jump_target(chunk, offset);
+      targets[target] = true;
+      if(chunk->code[offset] == OP_JUMP_IF_FALSE && target < count && chunk->code[target] == OP_POP) {
+        targets[target + 1] = true; // Where compare_jump() goes instead
+      }
+    }
+  }
+
+  int offset = 0;
+  while(offset < count) {
+    if(targets[offset]) {
+      // Other paths arrive with every value on the real stack
+      flush(&t);
+      t.result = -1;
+      if(depths[offset] != -1) {
+        t.depth = depths[offset];
+      }
+    }
+    offsets[offset] = t.count;
+    int result = t.result;
+    t.result = -1;
+
+    uint8_t opcode = chunk->code[offset];
+    int next = offset + instruction_length(chunk, offset);
+    switch(opcode) {
+    case OP_GET_LOCAL:
+      ensure_slot(&t, chunk->code[offset + 1]);
+      defer(&t, opcode, chunk->code[offset + 1], chunk->lines[offset]);
+      break;
+
+    case OP_CONSTANT:
+      defer(&t, opcode, chunk->code[offset + 1], chunk->lines[offset]);
+      break;
+
+    case OP_POP:
+      if(t.pending_count > 0) {
+        t.pending_count--; // Never pushed
+      }
+      else {
+        copy_instruction(&t, offset, depths);
+      }
+      break;
+
+    case OP_SET_LOCAL:
+      if(next < count && chunk->code[next] == OP_POP && !targets[next] && fits(&t)) {
+        t.result = result;
+        store_local(&t, chunk->code[offset + 1], chunk->lines[offset]);
+        t.result = -1;
+        offsets[next] = t.count;
+        next++;
+      }
+      else {
+        copy_instruction(&t, offset, depths);
+      }
+      break;
+
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS: {
+      int after = fits(&t) ? compare_jump(&t, offset, targets, depths) : -1;
+      if(after != -1) {
+        for(int i = offset + 1; i < after; i++) {
+          offsets[i] = t.count;
+        }
+        next = after;
+        break;
+      }
+    }
+      // fallthrough
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+      if(t.pending_count > 0 && fits(&t)) {
+        binary_operation(&t, offset);
+      }
+      else {
+        // Both operands are on the stack already, the stack instruction is as good
+        copy_instruction(&t, offset, depths);
+      }
+      break;
+
+    default:
+      copy_instruction(&t, offset, depths);
+      break;
+    }
+    offset = next;
+  }
+  flush(&t);
+  offsets[count] = t.count;
+
+  // The translated code may be longer, so a jump may not fit anymore: keep the stack code then
+  for(int i = 0; i < t.jump_count; i++) {
+    int at = t.jump_at[i];
+    int after = at + (t.code[at] == OP_JUMP || t.code[at] == OP_JUMP_IF_FALSE || t.code[at] == OP_LOOP
+                        ? 3
+                        : 7);
+    int jump = t.code[at] == OP_LOOP ? after - offsets[t.jump_to[i]] : offsets[t.jump_to[i]] - after;
+    if(jump > UINT16_MAX) {
+      FREE_ARRAY(uint8_t, t.code, t.capacity);
+      FREE_ARRAY(int, t.lines, t.capacity);
+      free_translator(&t, count, targets, offsets, depths);
+      return;
+    }
+    t.code[after - 2] = (jump >> 8) & 0xff;
+    t.code[after - 1] = jump & 0xff;
+  }
+
+  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY(int, chunk->lines, chunk->capacity);
+  chunk->code = t.code;
+  chunk->lines = t.lines;
+  chunk->count = t.count;
+  chunk->capacity = t.capacity;
+  free_translator(&t, count, targets, offsets, depths);
+}
@@ -0,0 +1,103 @@
+#include <memory.h>
+#include <shape.h>
+#include <vm.h>
+
+/* Every shape needs to map field names to slots. Copying the whole map into each shape would cost
+quadratic memory for instances with many fields, so a child reuses the table of its parent and
+appends its own field to it, as long as no other child already did. Slots are handed out in order
+along a chain, so an entry belongs to a shape only if its slot is below the field count of that
+shape: the entries appended by descendants are simply ignored. */
+
+obj_shape_t *shape_transition(obj_shape_t *shape, obj_string_t *name)
+{
+  // Returns the shape of an instance with the given shape after adding the field name.
+  value_t child;
+  if(table_get(&shape->transitions, name, &child)) {
+    return AS_SHAPE(child);
+  }
+
+  obj_shape_t *next = new_shape(shape, name);
+  // Linked to the parent first, since the tables below can trigger a GC.
+  push(OBJ_VAL(next));
+  table_set(&shape->transitions, name, OBJ_VAL(next));
+  // The key is the name of the child, so it's enough for the barrier to look at the child. The
+  // keys of the slots tables below are the names along the chain too: no barrier needed there.
+  write_barrier(&shape->base, OBJ_VAL(next));
+
+  if(shape->slots != NULL && shape->slots->count == shape->field_count) {
+    // Nobody has appended to the parent table yet
+    next->slots = shape->slots;
+  }
+  else {
+    table_t *slots = ALLOCATE(table_t, 1);
+    init_table(slots);
+    next->slots = slots;
+    next->owns_slots = true;
+    if(shape->slots != NULL) {
+      for(int i = 0; i < shape->slots->capacity; i++) {
+        entry_t *entry = &shape->slots->entries[i];
+        if(entry->key != NULL && AS_NUMBER(entry->value) < shape->field_count) {
+          table_set(slots, entry->key, entry->value);
+        }
+      }
+    }
+  }
+  table_set(next->slots, name, NUMBER_VAL(shape->field_count));
+  pop();
+  return next;
+}
+
+int shape_find_slot(obj_shape_t *shape, obj_string_t *name)
+{
+  // Returns -1 if instances with this shape have no such field.
+  value_t slot;
+  if(shape->slots == NULL || !table_get(shape->slots, name, &slot)
+     || AS_NUMBER(slot) >= shape->field_count) {
+    return -1;
+  }
+  return (int)AS_NUMBER(slot);
+}
+
+static void grow_fields(obj_instance_t *instance)
+{
+  // The inline fields can't grow with the instance, so move to a separate array.
+  int capacity = GROW_CAPACITY(instance->capacity);
+  value_t *fields = ALLOCATE(value_t, capacity);
+  for(int i = 0; i < instance->shape->field_count; i++) {
+    fields[i] = instance->fields[i];
+  }
+  if(instance->fields != instance->inline_fields) {
+    FREE_ARRAY(value_t, instance->fields, instance->capacity);
+  }
+  instance->fields = fields;
+  instance->capacity = capacity;
+}
+
+int instance_set_field(obj_instance_t *instance, obj_string_t *name, value_t value)
+{
+  // Returns the slot of the field.
+  // Adding a field can trigger a GC, so the caller must keep both instance and value reachable.
+  int slot = shape_find_slot(instance->shape, name);
+  if(slot != -1) {
+    instance->fields[slot] = value;
+    write_barrier(&instance->base, value);
+    return slot;
+  }
+
+  // The new shape is reachable from the current one until the instance switches to it.
+  obj_shape_t *shape = shape_transition(instance->shape, name);
+  slot = instance->shape->field_count;
+  if(slot == instance->capacity) {
+    grow_fields(instance);
+  }
+  instance->fields[slot] = value;
+  instance->shape = shape;
+  write_barrier(&instance->base, value);
+  write_barrier(&instance->base, OBJ_VAL(shape));
+
+  if(instance->klass->field_count < shape->field_count) {
+    instance->klass->field_count =
+        shape->field_count < INLINE_FIELDS_MAX ? shape->field_count : INLINE_FIELDS_MAX;
+  }
+  return slot;
+}
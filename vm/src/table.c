@@ -3,10 +3,12 @@
 #include <table.h>
 
 #define TABLE_MAX_LOAD_FACTOR 0.75
+#define TABLE_MAX_TOMBSTONES 0.25 // Share of the buckets past which the table is rebuilt
 
 void init_table(table_t *table)
 {
   table->count = 0;
+  table->tombstones = 0;
   table->capacity = 0;
   table->entries = NULL;
 }
@@ -55,6 +57,7 @@ static void adjust_capacity(table_t *table, int capacity)
   }
 
   table->count = 0;
+  table->tombstones = 0;
   for(int i = 0; i < table->capacity; i++) {
     entry_t *entry = &table->entries[i];
     if(entry->key == NULL) {
@@ -73,8 +76,18 @@ static void adjust_capacity(table_t *table, int capacity)
 
 bool table_set(table_t *table, obj_string_t *key, value_t value)
 {
-  if(table->count + 1 > table->capacity * TABLE_MAX_LOAD_FACTOR) {
-    int cap = GROW_CAPACITY(table->capacity);
+  /*
+  Tombstones keep the probe sequences going, so a table that deletes a lot (like the interned
+  strings, swept by the collector) gets slower and slower to search unless it is rebuilt now and
+  then. Rebuilding drops them, and sizes the table after the live entries only: it may not grow, or
+  even shrink. */
+  if(table->count + 1 > table->capacity * TABLE_MAX_LOAD_FACTOR
+     || table->tombstones > table->capacity * TABLE_MAX_TOMBSTONES) {
+    int live = table->count - table->tombstones + 1;
+    int cap = GROW_CAPACITY(0);
+    while(live > cap * TABLE_MAX_LOAD_FACTOR / 2) {
+      cap = GROW_CAPACITY(cap);
+    }
     adjust_capacity(table, cap);
   }
 
@@ -84,6 +97,9 @@ bool table_set(table_t *table, obj_string_t *key, value_t value)
     // tombestones contribute to load factor
     table->count++;
   }
+  else if(is_new_key) {
+    table->tombstones--;
+  }
 
   entry->key = key;
   entry->value = value;
@@ -130,6 +146,7 @@ bool table_delete(table_t *table, obj_string_t *key)
   // place a tombestone -> treated as full buckets, so count does not change
   entry->key = NULL;
   entry->value = BOOL_VAL(true);
+  table->tombstones++;
   return true;
 }
 
@@ -169,10 +186,13 @@ void mark_table(table_t *table)
 
 void table_remove_white(table_t *table)
 {
+  // The entry is at hand, no need to look the key up again like table_delete() does
   for(int i = 0; i < table->capacity; i++) {
     entry_t *entry = &table->entries[i];
     if(entry->key != NULL && !entry->key->base.is_marked) {
-      table_delete(table, entry->key);
+      entry->key = NULL;
+      entry->value = BOOL_VAL(true);
+      table->tombstones++;
     }
   }
 }
\ No newline at end of file
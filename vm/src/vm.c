@@ -2,8 +2,11 @@
 #include <debug.h>
 #include <memory.h>
 #include <object.h>
+#include <pool.h>
+#include <shape.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <vm.h>
@@ -22,6 +25,9 @@ static void reset_stack()
   g_vm.open_upvalues = NULL;
 }
 
+// Frames shown at each end of a long stack trace
+#define TRACE_FRAMES 10
+
 static void runtime_error(const char *format, ...)
 {
   va_list args;
@@ -30,9 +36,14 @@ static void runtime_error(const char *format, ...)
   va_end(args);
   fputs("\n", stderr);
 
-  // Print the stack trace.
-
+  // Print the stack trace. Deep recursion would print thousands of lines, so only the innermost and
+  // the outermost frames are shown then.
   for(int i = g_vm.frame_count - 1; i >= 0; i--) {
+    if(i == g_vm.frame_count - 1 - TRACE_FRAMES && i > TRACE_FRAMES) {
+      fprintf(stderr, "... %d more frames\n", i + 1 - TRACE_FRAMES);
+      i = TRACE_FRAMES;
+      continue;
+    }
     callframe_t *frame = &g_vm.frames[i];
     obj_function_t *function = frame->closure->function;
     size_t inst = frame->ip - function->chunk.code - 1; // -1 because ip points to next instruction
@@ -55,23 +66,71 @@ static void define_native(const char *name, native_fn_t function)
   // them. Recall that GC can run after any allocation is performed.
   push(OBJ_VAL(copy_string(name, (int)strlen(name))));
   push(OBJ_VAL(new_native(function)));
-  table_set(&g_vm.globals, AS_STRING(g_vm.stack[0]), g_vm.stack[1]);
+  int slot = global_slot(AS_STRING(g_vm.stack[0]));
+  g_vm.global_values.values[slot] = g_vm.stack[1];
   pop();
   pop();
 }
 
 void init_vm()
 {
+  g_vm.frames = (callframe_t *)malloc(sizeof(callframe_t) * FRAMES_INITIAL);
+  g_vm.stack = (value_t *)malloc(sizeof(value_t) * STACK_INITIAL);
+  if(g_vm.frames == NULL || g_vm.stack == NULL) {
+    exit(1);
+  }
+  g_vm.frame_capacity = FRAMES_INITIAL;
+  g_vm.stack_end = g_vm.stack + STACK_INITIAL;
   reset_stack();
   g_vm.objects = NULL;
+  g_vm.young_objects = NULL;
+  g_vm.young_tail = NULL;
   g_vm.gray_count = 0;
   g_vm.gray_capacity = 0;
   g_vm.gray_stack = NULL;
+  g_vm.remembered_count = 0;
+  g_vm.remembered_capacity = 0;
+  g_vm.remembered = NULL;
 
   g_vm.bytes_allocated = 0;
-  g_vm.next_gc = 1024 * 1024;
+  g_vm.next_gc = GC_INITIAL_HEAP;
+  g_vm.gc_growth = GC_HEAP_GROWTH_FACTOR;
+  g_vm.gc_min_heap = 0;
+  g_vm.gc_soft_limit = 0;
+  g_vm.gc_max_heap = 0;
+  g_vm.heap_exhausted = false;
+  g_vm.nursery_bytes = 0;
+
+  g_vm.gc_incremental = false;
+  g_vm.gc_step_objects = GC_STEP_OBJECTS;
+  g_vm.gc_step_us = 0;
+  g_vm.gc_phase = GC_IDLE;
+  g_vm.gc_threads = 1;
+  g_vm.gc_compact = 0;
+  g_vm.compact_pending = false;
+  g_vm.gc_cursor = NULL;
+  g_vm.gc_sweep = NULL;
+
+  g_vm.gc_stats = NULL;
+  g_vm.gc_stats_dump = false;
+  g_vm.register_backend = false;
+#ifdef DEBUG_GC_PAUSES
+  enable_gc_stats();
+#endif
 
-  init_table(&g_vm.globals);
+#ifdef DEBUG_INLINE_CACHE
+  g_vm.cache_hits = 0;
+  g_vm.cache_misses = 0;
+  g_vm.cache_megamorphic = 0;
+#endif
+#ifdef DEBUG_OPCODE_PAIRS
+  memset(g_vm.opcode_pairs, 0, sizeof(g_vm.opcode_pairs));
+  g_vm.last_opcode = -1;
+#endif
+
+  init_table(&g_vm.global_slots);
+  init_value_array(&g_vm.global_names);
+  init_value_array(&g_vm.global_values);
   init_table(&g_vm.strings);
 
   g_vm.init_string = NULL; // Note this: copy_string can cause GC to run and mark `init_string`,
@@ -81,16 +140,111 @@ void init_vm()
   define_native("clock", clock_native);
 }
 
+#ifdef DEBUG_OPCODE_PAIRS
+#define OPCODE_PAIRS_SHOWN 24
+
+typedef struct {
+  uint8_t first;
+  uint8_t second;
+  size_t count;
+} opcode_pair_t;
+
+static int compare_pairs(const void *a, const void *b)
+{
+  size_t x = ((const opcode_pair_t *)a)->count;
+  size_t y = ((const opcode_pair_t *)b)->count;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// The most frequent pairs of consecutive opcodes are the candidates for superinstructions
+static void print_opcode_pairs()
+{
+  static opcode_pair_t pairs[OP_COUNT * OP_COUNT];
+  int count = 0;
+  size_t total = 0;
+  for(int first = 0; first < OP_COUNT; first++) {
+    for(int second = 0; second < OP_COUNT; second++) {
+      size_t n = g_vm.opcode_pairs[first][second];
+      if(n > 0) {
+        pairs[count++] = (opcode_pair_t){first, second, n};
+        total += n;
+      }
+    }
+  }
+  qsort(pairs, count, sizeof(opcode_pair_t), compare_pairs);
+
+  printf("-- opcode pairs: %zu executed\n", total);
+  for(int i = 0; i < count && i < OPCODE_PAIRS_SHOWN; i++) {
+    printf("%-20s %-20s %12zu %5.1f%%\n", opcode_name(pairs[i].first), opcode_name(pairs[i].second),
+           pairs[i].count, 100.0 * pairs[i].count / total);
+  }
+}
+#endif
+
 void free_vm()
 {
+#ifdef DEBUG_INLINE_CACHE
+  printf("-- inline caches: %zu hits, %zu misses, %zu megamorphic lookups\n", g_vm.cache_hits,
+         g_vm.cache_misses, g_vm.cache_megamorphic);
+#endif
+#ifdef DEBUG_OPCODE_PAIRS
+  print_opcode_pairs();
+#endif
+#ifdef DEBUG_GC_PAUSES
+  print_gc_pauses();
+#endif
+  if(g_vm.gc_stats_dump) {
+    print_gc_stats(stderr);
+  }
+
   g_vm.init_string = NULL;
   free_objects();
-  free_table(&g_vm.globals);
+  free_table(&g_vm.global_slots);
+  free_value_array(&g_vm.global_names);
+  free_value_array(&g_vm.global_values);
   free_table(&g_vm.strings);
+#ifdef POOL_ALLOCATOR
+  free_pools();
+#endif
+  free_gc_stats();
+  free(g_vm.frames);
+  free(g_vm.stack);
+}
+
+// Moves a pointer into the stack that was at `old_stack` before it grew
+static value_t *relocate(value_t *pointer, uintptr_t old_stack)
+{
+  return g_vm.stack + ((uintptr_t)pointer - old_stack) / sizeof(value_t);
+}
+
+// Makes room for at least `count` values on the stack
+static void grow_stack(size_t count)
+{
+  size_t capacity = g_vm.stack_end - g_vm.stack;
+  while(capacity < count) {
+    capacity = GROW_CAPACITY(capacity);
+  }
+  uintptr_t old_stack = (uintptr_t)g_vm.stack;
+  // Not managed by the GC, like the gray stack
+  g_vm.stack = (value_t *)realloc(g_vm.stack, sizeof(value_t) * capacity);
+  if(g_vm.stack == NULL) {
+    exit(1);
+  }
+  g_vm.stack_end = g_vm.stack + capacity;
+  g_vm.stack_top = relocate(g_vm.stack_top, old_stack);
+  for(int i = 0; i < g_vm.frame_count; i++) {
+    g_vm.frames[i].slots = relocate(g_vm.frames[i].slots, old_stack);
+  }
+  for(obj_upvalue_t *upvalue = g_vm.open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+    upvalue->location = relocate(upvalue->location, old_stack);
+  }
 }
 
 void push(value_t value)
 {
+  if(g_vm.stack_top >= g_vm.stack_end) {
+    grow_stack(g_vm.stack_end - g_vm.stack + 1);
+  }
   *g_vm.stack_top = value;
   g_vm.stack_top++;
 }
@@ -112,18 +266,36 @@ static bool call(obj_closure_t *closure, int arg_count)
   }
 
   // We need to prepare a new call frame for run(). Enough room?
-  if(g_vm.frame_count == FAMES_MAX) {
-    runtime_error("Stack overflow.");
-    return false;
+  if(g_vm.frame_count == g_vm.frame_capacity) {
+    if(g_vm.frame_count == FAMES_MAX) {
+      runtime_error("Stack overflow.");
+      return false;
+    }
+    // Whoever holds a frame pointer reloads it after the call
+    int capacity = GROW_CAPACITY(g_vm.frame_capacity);
+    g_vm.frame_capacity = capacity < FAMES_MAX ? capacity : FAMES_MAX;
+    g_vm.frames = (callframe_t *)realloc(g_vm.frames, sizeof(callframe_t) * g_vm.frame_capacity);
+    if(g_vm.frames == NULL) {
+      exit(1);
+    }
   }
 
-  callframe_t *frame = &g_vm.frames[g_vm.frame_count++];
-  frame->closure = closure;
-  frame->ip = closure->function->chunk.code;
   // The -1 accounts for the fact that locals (the actual parameters) start at 1.
   // For methods, the first slot is reserved for `this`. For functions, it simply holds the closure
   // itself.
-  frame->slots = g_vm.stack_top - arg_count - 1;
+  value_t *slots = g_vm.stack_top - arg_count - 1;
+  // Register instructions write slots without push(), see registers.c. Their slots all fit in a
+  // byte, so that much room is enough.
+  if(g_vm.stack_end - slots < UINT8_COUNT) {
+    size_t base = slots - g_vm.stack;
+    grow_stack(base + UINT8_COUNT);
+    slots = g_vm.stack + base;
+  }
+
+  callframe_t *frame = &g_vm.frames[g_vm.frame_count++];
+  frame->closure = closure;
+  frame->ip = closure->function->chunk.code;
+  frame->slots = slots;
   return true;
 }
 
@@ -177,18 +349,77 @@ static bool call_value(value_t callee, int arg_count)
   return false;
 }
 
+#ifdef DEBUG_INLINE_CACHE
+#define CACHE_STAT(counter) (g_vm.counter++)
+#else
+#define CACHE_STAT(counter) ((void)0)
+#endif
+
+static cache_entry_t *cache_lookup(inline_cache_t *cache, obj_shape_t *shape)
+{
+  if(cache == NULL || cache->megamorphic) {
+    return NULL;
+  }
+  for(int i = 0; i < cache->count; i++) {
+    if(cache->entries[i].shape == shape) {
+      return &cache->entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void cache_miss(inline_cache_t *cache, obj_shape_t *shape, obj_closure_t *method, int slot,
+                       obj_shape_t *transition)
+{
+  // Remember what the generic lookup resolved to for this receiver shape.
+  if(cache == NULL) {
+    return;
+  }
+  if(cache->megamorphic) {
+    CACHE_STAT(cache_megamorphic);
+    return;
+  }
+  CACHE_STAT(cache_misses);
+
+  cache_entry_t *entry = cache_lookup(cache, shape);
+  if(entry == NULL) {
+    if(cache->count == INLINE_CACHE_ENTRIES) {
+      // Too many receiver shapes at this site: give up and always take the generic path
+      cache->megamorphic = true;
+      return;
+    }
+    entry = &cache->entries[cache->count++];
+  }
+  entry->shape = shape;
+  entry->method = method;
+  entry->transition = transition;
+  entry->slot = slot;
+  // The caches belong to the function running in the topmost frame
+  write_barrier_object(&g_vm.frames[g_vm.frame_count - 1].closure->function->base);
+}
+
+static bool find_method(obj_class_t *klass, obj_string_t *name, obj_closure_t **method)
+{
+  value_t value;
+  if(!table_get(&klass->methods, name, &value)) {
+    runtime_error("Undefined property '%s'.", name->chars);
+    return false;
+  }
+  *method = AS_CLOSURE(value);
+  return true;
+}
+
 static bool invoke_from_class(obj_class_t *klass, obj_string_t *name, int arg_count)
 {
   // This combines the logic of OP_GET_PROPERTY and OP_CALL together.
-  value_t method;
-  if(!table_get(&klass->methods, name, &method)) {
-    runtime_error("Undefined property '%s'.", name->chars);
+  obj_closure_t *method;
+  if(!find_method(klass, name, &method)) {
     return false;
   }
-  return call(AS_CLOSURE(method), arg_count);
+  return call(method, arg_count);
 }
 
-static bool invoke(obj_string_t *name, int arg_count)
+static bool invoke(obj_string_t *name, int arg_count, inline_cache_t *cache)
 {
   value_t receiver = peek(arg_count);
 
@@ -198,32 +429,134 @@ static bool invoke(obj_string_t *name, int arg_count)
   }
 
   obj_instance_t *instance = AS_INSTANCE(receiver);
-  // What if the name is a field that is a callable?
-  value_t value;
-  if(table_get(&instance->fields, name, &value)) {
+  // A shape belongs to a single class and tells which fields are there, so it is enough to know
+  // that the name is not shadowed by a field and which method it resolves to.
+  cache_entry_t *entry = cache_lookup(cache, instance->shape);
+  if(entry != NULL) {
+    CACHE_STAT(cache_hits);
+    if(entry->method != NULL) {
+      return call(entry->method, arg_count);
+    }
+    value_t value = instance->fields[entry->slot];
     g_vm.stack_top[-arg_count - 1] = value; // Replace the receiver with the field value.
     return call_value(value, arg_count);
   }
-  return invoke_from_class(instance->klass, name, arg_count);
+
+  // What if the name is a field that is a callable?
+  int slot = shape_find_slot(instance->shape, name);
+  if(slot != -1) {
+    cache_miss(cache, instance->shape, NULL, slot, NULL);
+    value_t value = instance->fields[slot];
+    g_vm.stack_top[-arg_count - 1] = value;
+    return call_value(value, arg_count);
+  }
+
+  obj_closure_t *method;
+  if(!find_method(instance->klass, name, &method)) {
+    return false;
+  }
+  cache_miss(cache, instance->shape, method, -1, NULL);
+  return call(method, arg_count);
+}
+
+static void bind(obj_closure_t *method)
+{
+  // Wrap the class method in a bound method, replacing the instance on top of the stack
+  obj_bound_method_t *bound = new_bound_method(peek(0), method);
+  pop(); // Instance
+  push(OBJ_VAL(bound));
 }
 
 static bool bind_method(obj_class_t *klass, obj_string_t *name)
 {
   // Places the bound method on the stack if found.
-  value_t method;
-
-  if(!table_get(&klass->methods, name, &method)) {
-    runtime_error("Undefined property '%s'.", name->chars);
+  obj_closure_t *method;
+  if(!find_method(klass, name, &method)) {
     return false;
   }
+  bind(method);
+  return true;
+}
 
-  // Wrap the class method in a bound method
-  obj_bound_method_t *bound = new_bound_method(peek(0), AS_CLOSURE(method));
-  pop(); // Instance
-  push(OBJ_VAL(bound));
+static void load_method(obj_closure_t *method, bool pair)
+{
+  // A pair keeps the instance where it is and pushes the method right above it, so that nothing is
+  // allocated until the pair escapes.
+  if(pair) {
+    push(OBJ_VAL(method));
+  }
+  else {
+    bind(method);
+  }
+}
+
+static bool get_property(obj_string_t *name, inline_cache_t *cache, bool pair)
+{
+  // Replaces the instance on top of the stack with the value of the property. With `pair`, fields
+  // are followed by nil and methods by the closure, see OP_GET_PROPERTY_PAIR.
+  obj_instance_t *instance = AS_INSTANCE(peek(0));
+
+  cache_entry_t *entry = cache_lookup(cache, instance->shape);
+  if(entry != NULL) {
+    CACHE_STAT(cache_hits);
+    if(entry->method != NULL) {
+      load_method(entry->method, pair);
+      return true;
+    }
+    g_vm.stack_top[-1] = instance->fields[entry->slot];
+  }
+  else {
+    int slot = shape_find_slot(instance->shape, name);
+    if(slot == -1) {
+      // Fields shadow methods
+      obj_closure_t *method;
+      if(!find_method(instance->klass, name, &method)) {
+        return false;
+      }
+      cache_miss(cache, instance->shape, method, -1, NULL);
+      load_method(method, pair);
+      return true;
+    }
+    cache_miss(cache, instance->shape, NULL, slot, NULL);
+    g_vm.stack_top[-1] = instance->fields[slot];
+  }
+
+  if(pair) {
+    push(NIL_VAL);
+  }
   return true;
 }
 
+static void set_property(obj_string_t *name, inline_cache_t *cache)
+{
+  // The value is on top of the stack, the instance right below.
+  obj_instance_t *instance = AS_INSTANCE(peek(1));
+  obj_shape_t *shape = instance->shape;
+
+  cache_entry_t *entry = cache_lookup(cache, shape);
+  if(entry != NULL && entry->transition == NULL) {
+    // Store to an existing field
+    CACHE_STAT(cache_hits);
+    instance->fields[entry->slot] = peek(0);
+    write_barrier(&instance->base, peek(0));
+    return;
+  }
+  if(entry != NULL && entry->slot < instance->capacity) {
+    // Adding the field, and there is room for it: typically the initializer of a class whose
+    // instances are already sized for their fields.
+    CACHE_STAT(cache_hits);
+    instance->fields[entry->slot] = peek(0);
+    instance->shape = entry->transition;
+    write_barrier(&instance->base, peek(0));
+    write_barrier(&instance->base, OBJ_VAL(instance->shape));
+    return;
+  }
+
+  // Adding a field can trigger a GC, that's why both operands are still on the stack.
+  int slot = instance_set_field(instance, name, peek(0));
+  cache_miss(cache, shape, NULL, slot, instance->shape == shape ? NULL : instance->shape);
+}
+
 static obj_upvalue_t *capture_upvalue(value_t *local)
 {
   // Start at the upvalue closest to the top of the stack.
@@ -262,10 +595,28 @@ static void close_upvalues(value_t *last)
     obj_upvalue_t *upvalue = g_vm.open_upvalues;
     upvalue->closed = *upvalue->location;
     upvalue->location = &upvalue->closed;
+    write_barrier(&upvalue->base, upvalue->closed);
     g_vm.open_upvalues = upvalue->next;
   }
 }
 
+/* A tail call pushed the frame of the callee on top of the frame that made it, which has nothing
+left to do. The callee takes the place of the caller: its closure and arguments slide down to the
+slots of the caller, whose upvalues are closed first, so that tail recursion runs in constant frame
+and stack space. */
+static void reuse_frame()
+{
+  callframe_t *callee = &g_vm.frames[g_vm.frame_count - 1];
+  callframe_t *caller = callee - 1;
+  close_upvalues(caller->slots);
+  int count = (int)(g_vm.stack_top - callee->slots);
+  memmove(caller->slots, callee->slots, sizeof(value_t) * count);
+  caller->closure = callee->closure;
+  caller->ip = callee->ip;
+  g_vm.stack_top = caller->slots + count;
+  g_vm.frame_count--;
+}
+
 static void define_method(obj_string_t *name)
 {
   // On the stack we find the closure of the method!
@@ -273,14 +624,10 @@ static void define_method(obj_string_t *name)
   // Right below the class!
   obj_class_t *klass = AS_CLASS(peek(1));
   table_set(&klass->methods, name, method);
+  write_barrier_object(&klass->base);
   pop(); // Pop the closure
 }
 
-static bool isFalsey(value_t value)
-{
-  return IS_NIL(value) || (IS_BOOL(value) && AS_BOOL(value) == false);
-}
-
 static void concatenate()
 {
   obj_string_t *b = AS_STRING(peek(0));
@@ -308,20 +655,80 @@ static void concatenate()
     push(OBJ_VAL(res));
     table_set(&g_vm.strings, res, NIL_VAL);
   }
-  FREE(char, chars);
+  FREE_ARRAY(char, chars, new_length + 1);
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void trace_execution(callframe_t *frame, uint8_t *ip)
+{
+  printf("          ");
+  for(value_t *slot = g_vm.stack; slot < g_vm.stack_top; slot++) {
+    printf("[ ");
+    print_value(*slot);
+    printf(" ]");
+  }
+  printf("\n");
+  disassemble_instruction(&frame->closure->function->chunk,
+                          (int)(ip - frame->closure->function->chunk.code));
 }
+#endif
+
+#ifdef DEBUG_OPCODE_PAIRS
+static inline void count_pair(uint8_t opcode)
+{
+  if(g_vm.last_opcode != -1) {
+    g_vm.opcode_pairs[g_vm.last_opcode][opcode]++;
+  }
+  g_vm.last_opcode = opcode;
+}
+#endif
 
 static interpret_result_t run()
 {
   callframe_t *frame = &g_vm.frames[g_vm.frame_count - 1];
+  // The instruction pointer of the current frame is kept in a local, so that the compiler can keep
+  // it in a register. It must be written back to the frame before anything that reads frame->ip,
+  // i.e. before pushing a new frame or reporting a runtime error.
+  uint8_t *ip = frame->ip;
 
-#define READ_BYTE() (*frame->ip++)
+#define SAVE_IP() (frame->ip = ip)
+#define LOAD_FRAME()                                                                               \
+  do {                                                                                             \
+    frame = &g_vm.frames[g_vm.frame_count - 1];                                                    \
+    ip = frame->ip;                                                                                \
+  } while(false)
+// Compacting the heap moves objects, so it only happens where no C local holds on to one: between
+// two instructions. Loops and calls check for it, so a running program gets there soon. Running out
+// of memory is reported there too, since an allocation can't fail halfway through an instruction.
+#ifdef POOL_ALLOCATOR
+#define COMPACT_HEAP()                                                                             \
+  if(g_vm.compact_pending) {                                                                       \
+    SAVE_IP();                                                                                     \
+    compact_heap();                                                                                \
+    LOAD_FRAME();                                                                                  \
+  }
+#else
+#define COMPACT_HEAP()
+#endif
+#define SAFEPOINT()                                                                                \
+  do {                                                                                             \
+    if(g_vm.heap_exhausted) {                                                                      \
+      SAVE_IP();                                                                                   \
+      g_vm.heap_exhausted = false;                                                                 \
+      runtime_error("Out of memory.");                                                             \
+      return INTERPRET_RUNTIME_ERROR;                                                              \
+    }                                                                                              \
+    COMPACT_HEAP()                                                                                 \
+  } while(false)
+#define READ_BYTE() (*ip++)
 #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
-#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_CACHE() (&frame->closure->function->chunk.caches[READ_SHORT()])
 #define BINARY_OP(value_type, op)                                                                  \
   do {                                                                                             \
     if(!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                                               \
+      SAVE_IP();                                                                                   \
       runtime_error("Operands must be numbers.");                                                  \
       return INTERPRET_RUNTIME_ERROR;                                                              \
     }                                                                                              \
@@ -330,183 +737,402 @@ static interpret_result_t run()
     push(value_type(a op b));                                                                      \
   } while(false)
 
-  for(;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-    printf("          ");
-    for(value_t *slot = g_vm.stack; slot < g_vm.stack_top; slot++) {
-      printf("[ ");
-      print_value(*slot);
-      printf(" ]");
-    }
-    printf("\n");
-    disassemble_instruction(&frame->closure->function->chunk,
-                            (int)(frame->ip - frame->closure->function->chunk.code));
+// Register instructions, see registers.c. The operands are slots of the frame, the last one is a
+// constant in the K forms. The first byte is the depth of the stack once the instruction is done.
+#define READ_REGISTER() (frame->slots[READ_BYTE()])
+#define REGISTER_OP(value_type, op, read_c)                                                        \
+  do {                                                                                             \
+    g_vm.stack_top = frame->slots + READ_BYTE();                                                   \
+    uint8_t dst = READ_BYTE();                                                                     \
+    value_t b = READ_REGISTER();                                                                   \
+    value_t c = read_c;                                                                            \
+    if(!IS_NUMBER(b) || !IS_NUMBER(c)) {                                                           \
+      SAVE_IP();                                                                                   \
+      runtime_error("Operands must be numbers.");                                                  \
+      return INTERPRET_RUNTIME_ERROR;                                                              \
+    }                                                                                              \
+    frame->slots[dst] = value_type(AS_NUMBER(b) op AS_NUMBER(c));                                  \
+  } while(false)
+#define REGISTER_ADD(read_c)                                                                       \
+  do {                                                                                             \
+    g_vm.stack_top = frame->slots + READ_BYTE();                                                   \
+    uint8_t dst = READ_BYTE();                                                                     \
+    value_t b = READ_REGISTER();                                                                   \
+    value_t c = read_c;                                                                            \
+    if(IS_NUMBER(b) && IS_NUMBER(c)) {                                                             \
+      frame->slots[dst] = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c));                                 \
+    }                                                                                              \
+    else if(IS_STRING(b) && IS_STRING(c)) {                                                        \
+      /* The destination may be a slot that held nothing yet, the collector must not see it */    \
+      frame->slots[dst] = NIL_VAL;                                                                 \
+      push(b);                                                                                     \
+      push(c);                                                                                     \
+      concatenate();                                                                               \
+      frame->slots[dst] = pop();                                                                   \
+    }                                                                                              \
+    else {                                                                                         \
+      SAVE_IP();                                                                                   \
+      runtime_error("Operands must be two numbers or two strings.");                               \
+      return INTERPRET_RUNTIME_ERROR;                                                              \
+    }                                                                                              \
+  } while(false)
+#define REGISTER_EQUAL(read_c)                                                                     \
+  do {                                                                                             \
+    g_vm.stack_top = frame->slots + READ_BYTE();                                                   \
+    uint8_t dst = READ_BYTE();                                                                     \
+    value_t b = READ_REGISTER();                                                                   \
+    frame->slots[dst] = BOOL_VAL(values_equal(b, read_c));                                         \
+  } while(false)
+// The condition is never pushed, so the jump goes past the POP that would drop it
+#define REGISTER_JUMP(op, read_c)                                                                  \
+  do {                                                                                             \
+    g_vm.stack_top = frame->slots + READ_BYTE();                                                   \
+    bool jump_if = READ_BYTE();                                                                    \
+    value_t b = READ_REGISTER();                                                                   \
+    value_t c = read_c;                                                                            \
+    uint16_t offset = READ_SHORT();                                                                \
+    if(!IS_NUMBER(b) || !IS_NUMBER(c)) {                                                           \
+      SAVE_IP();                                                                                   \
+      runtime_error("Operands must be numbers.");                                                  \
+      return INTERPRET_RUNTIME_ERROR;                                                              \
+    }                                                                                              \
+    if((AS_NUMBER(b) op AS_NUMBER(c)) == jump_if) {                                                \
+      ip += offset;                                                                                \
+    }                                                                                              \
+  } while(false)
+#define REGISTER_EQUAL_JUMP(read_c)                                                                \
+  do {                                                                                             \
+    g_vm.stack_top = frame->slots + READ_BYTE();                                                   \
+    bool jump_if = READ_BYTE();                                                                    \
+    value_t b = READ_REGISTER();                                                                   \
+    value_t c = read_c;                                                                            \
+    uint16_t offset = READ_SHORT();                                                                \
+    if(values_equal(b, c) == jump_if) {                                                            \
+      ip += offset;                                                                                \
+    }                                                                                              \
+  } while(false)
+
+#if defined(DEBUG_TRACE_EXECUTION)
+#define NEXT_INSTRUCTION() (trace_execution(frame, ip), READ_BYTE())
+#elif defined(DEBUG_OPCODE_PAIRS)
+#define NEXT_INSTRUCTION() (count_pair(*ip), READ_BYTE())
+#else
+#define NEXT_INSTRUCTION() READ_BYTE()
+#endif
+
+#ifdef COMPUTED_GOTO
+  /* Direct threading: every handler jumps straight to the handler of the next instruction through
+  this table, instead of going back to a single switch. That saves the switch bounds check and gives
+  the branch predictor one indirect jump per opcode to learn from. */
+  static void *dispatch_table[] = {
+    [OP_CONSTANT] = &&label_OP_CONSTANT,
+    [OP_NIL] = &&label_OP_NIL,
+    [OP_TRUE] = &&label_OP_TRUE,
+    [OP_FALSE] = &&label_OP_FALSE,
+    [OP_POP] = &&label_OP_POP,
+    [OP_GET_LOCAL] = &&label_OP_GET_LOCAL,
+    [OP_SET_LOCAL] = &&label_OP_SET_LOCAL,
+    [OP_SET_LOCAL_POP] = &&label_OP_SET_LOCAL_POP,
+    [OP_INC_LOCAL] = &&label_OP_INC_LOCAL,
+    [OP_GET_GLOBAL] = &&label_OP_GET_GLOBAL,
+    [OP_DEFINE_GLOBAL] = &&label_OP_DEFINE_GLOBAL,
+    [OP_SET_GLOBAL] = &&label_OP_SET_GLOBAL,
+    [OP_GET_UPVALUE] = &&label_OP_GET_UPVALUE,
+    [OP_SET_UPVALUE] = &&label_OP_SET_UPVALUE,
+    [OP_SET_PROPERTY] = &&label_OP_SET_PROPERTY,
+    [OP_GET_PROPERTY] = &&label_OP_GET_PROPERTY,
+    [OP_GET_SUPER] = &&label_OP_GET_SUPER,
+    [OP_GET_PROPERTY_PAIR] = &&label_OP_GET_PROPERTY_PAIR,
+    [OP_GET_SUPER_PAIR] = &&label_OP_GET_SUPER_PAIR,
+    [OP_GET_LOCAL_PAIR] = &&label_OP_GET_LOCAL_PAIR,
+    [OP_EQUAL] = &&label_OP_EQUAL,
+    [OP_GREATER] = &&label_OP_GREATER,
+    [OP_LESS] = &&label_OP_LESS,
+    [OP_ADD] = &&label_OP_ADD,
+    [OP_ADD_LOCALS] = &&label_OP_ADD_LOCALS,
+    [OP_ADD_CONSTANT] = &&label_OP_ADD_CONSTANT,
+    [OP_SUBTRACT] = &&label_OP_SUBTRACT,
+    [OP_MULTIPLY] = &&label_OP_MULTIPLY,
+    [OP_DIVIDE] = &&label_OP_DIVIDE,
+    [OP_NOT] = &&label_OP_NOT,
+    [OP_NEGATE] = &&label_OP_NEGATE,
+    [OP_PRINT] = &&label_OP_PRINT,
+    [OP_JUMP] = &&label_OP_JUMP,
+    [OP_JUMP_IF_FALSE] = &&label_OP_JUMP_IF_FALSE,
+    [OP_LESS_JUMP] = &&label_OP_LESS_JUMP,
+    [OP_LOOP] = &&label_OP_LOOP,
+    [OP_CALL] = &&label_OP_CALL,
+    [OP_TAIL_CALL] = &&label_OP_TAIL_CALL,
+    [OP_CALL_PAIR] = &&label_OP_CALL_PAIR,
+    [OP_INVOKE] = &&label_OP_INVOKE,
+    [OP_TAIL_INVOKE] = &&label_OP_TAIL_INVOKE,
+    [OP_SUPER_INVOKE] = &&label_OP_SUPER_INVOKE,
+    [OP_CLOSURE] = &&label_OP_CLOSURE,
+    [OP_CLOSE_UPVALUE] = &&label_OP_CLOSE_UPVALUE,
+    [OP_RETURN] = &&label_OP_RETURN,
+    [OP_CLASS] = &&label_OP_CLASS,
+    [OP_INHERIT] = &&label_OP_INHERIT,
+    [OP_METHOD] = &&label_OP_METHOD,
+    [OP_REG_MOVE] = &&label_OP_REG_MOVE,
+    [OP_REG_LOADK] = &&label_OP_REG_LOADK,
+    [OP_REG_ADD] = &&label_OP_REG_ADD,
+    [OP_REG_ADDK] = &&label_OP_REG_ADDK,
+    [OP_REG_SUBTRACT] = &&label_OP_REG_SUBTRACT,
+    [OP_REG_SUBTRACTK] = &&label_OP_REG_SUBTRACTK,
+    [OP_REG_MULTIPLY] = &&label_OP_REG_MULTIPLY,
+    [OP_REG_MULTIPLYK] = &&label_OP_REG_MULTIPLYK,
+    [OP_REG_DIVIDE] = &&label_OP_REG_DIVIDE,
+    [OP_REG_DIVIDEK] = &&label_OP_REG_DIVIDEK,
+    [OP_REG_EQUAL] = &&label_OP_REG_EQUAL,
+    [OP_REG_EQUALK] = &&label_OP_REG_EQUALK,
+    [OP_REG_GREATER] = &&label_OP_REG_GREATER,
+    [OP_REG_GREATERK] = &&label_OP_REG_GREATERK,
+    [OP_REG_LESS] = &&label_OP_REG_LESS,
+    [OP_REG_LESSK] = &&label_OP_REG_LESSK,
+    [OP_REG_EQUAL_JUMP] = &&label_OP_REG_EQUAL_JUMP,
+    [OP_REG_EQUAL_JUMPK] = &&label_OP_REG_EQUAL_JUMPK,
+    [OP_REG_GREATER_JUMP] = &&label_OP_REG_GREATER_JUMP,
+    [OP_REG_GREATER_JUMPK] = &&label_OP_REG_GREATER_JUMPK,
+    [OP_REG_LESS_JUMP] = &&label_OP_REG_LESS_JUMP,
+    [OP_REG_LESS_JUMPK] = &&label_OP_REG_LESS_JUMPK,
+  };
+#define INTERPRET_LOOP DISPATCH();
+#define CASE(op) label_##op:
+#define DISPATCH() goto *dispatch_table[NEXT_INSTRUCTION()]
+#else
+#define INTERPRET_LOOP for(;;) switch(NEXT_INSTRUCTION())
+#define CASE(op) case op:
+#define DISPATCH() continue
 #endif
 
-    uint8_t instruction = READ_BYTE();
-    switch(instruction) {
-    case OP_CONSTANT: {
+  INTERPRET_LOOP
+  {
+    CASE(OP_CONSTANT) {
       value_t constant = READ_CONSTANT();
       push(constant);
-      break;
+      DISPATCH();
     }
 
-    case OP_NIL: {
+    CASE(OP_NIL) {
       push(NIL_VAL);
-      break;
+      DISPATCH();
     }
 
-    case OP_TRUE: {
+    CASE(OP_TRUE) {
       push(BOOL_VAL(true));
-      break;
+      DISPATCH();
     }
 
-    case OP_FALSE: {
+    CASE(OP_FALSE) {
       push(BOOL_VAL(false));
-      break;
+      DISPATCH();
     }
 
-    case OP_POP: {
+    CASE(OP_POP) {
       pop();
-      break;
+      DISPATCH();
     }
 
-    case OP_GET_LOCAL: {
+    CASE(OP_GET_LOCAL) {
       /*
       Next byte holds the argument, i.e. the slot in the stack, starting from the bottom of the
       frame. Notice that while it may seem redundant to push a value already somewhere down in the
       stack it is not, because other instructions look at the stack top. */
       uint8_t slot = READ_BYTE();
       push(frame->slots[slot]);
-      break;
+      DISPATCH();
     }
 
-    case OP_SET_LOCAL: {
+    CASE(OP_SET_LOCAL) {
       /*
       Next byte holds the argument, i.e. the slot in the stack, starting from the bottom of
       the frame, where the local lives. Again, no pop since this comes from an expression statement.
       In other words, every expression produces a value. */
       uint8_t slot = READ_BYTE();
       frame->slots[slot] = peek(0);
-      break;
+      DISPATCH();
     }
 
-    case OP_GET_GLOBAL: {
-      obj_string_t *name = READ_STRING();
-      value_t value;
-      if(!table_get(&g_vm.globals, name, &value)) {
-        runtime_error("Undefined variable '%s'.", name->chars);
+    /* Superinstructions, see peephole.c. Each one does the work of the sequence it replaces, with
+    the same errors. */
+    CASE(OP_SET_LOCAL_POP) {
+      uint8_t slot = READ_BYTE();
+      frame->slots[slot] = pop();
+      DISPATCH();
+    }
+
+    CASE(OP_INC_LOCAL) {
+      // The constant is always a number
+      uint8_t slot = READ_BYTE();
+      value_t constant = READ_CONSTANT();
+      if(!IS_NUMBER(frame->slots[slot])) {
+        SAVE_IP();
+        runtime_error("Operands must be two numbers or two strings.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame->slots[slot] = NUMBER_VAL(AS_NUMBER(frame->slots[slot]) + AS_NUMBER(constant));
+      DISPATCH();
+    }
+
+    CASE(OP_GET_GLOBAL) {
+      uint16_t slot = READ_SHORT();
+      value_t value = g_vm.global_values.values[slot];
+      if(IS_UNDEFINED(value)) {
+        SAVE_IP();
+        runtime_error("Undefined variable '%s'.", AS_CSTRING(g_vm.global_names.values[slot]));
         return INTERPRET_RUNTIME_ERROR;
       }
       push(value);
-      break;
+      DISPATCH();
     }
 
-    case OP_DEFINE_GLOBAL: {
-      obj_string_t *name = READ_STRING();
+    CASE(OP_DEFINE_GLOBAL) {
       /* Can redefine globals
       Recall that this instruction comes from a declaration(), not an expression statement
-      so we do the pop here.
-      Note pop after table set: GC may trigger after a pop(), and during table_set()
-      thus mistakenly collecting the string. */
-      table_set(&g_vm.globals, name, peek(0));
-      pop();
-      break;
+      so we do the pop here. */
+      g_vm.global_values.values[READ_SHORT()] = pop();
+      DISPATCH();
     }
 
-    case OP_SET_GLOBAL: {
-      obj_string_t *name = READ_STRING();
-      if(table_set(&g_vm.globals, name, peek(0))) {
-        // table_set adds it even if undefined
-        table_delete(&g_vm.globals, name);
-        runtime_error("Undefined variable '%s'.", name->chars);
+    CASE(OP_SET_GLOBAL) {
+      uint16_t slot = READ_SHORT();
+      if(IS_UNDEFINED(g_vm.global_values.values[slot])) {
+        SAVE_IP();
+        runtime_error("Undefined variable '%s'.", AS_CSTRING(g_vm.global_names.values[slot]));
         return INTERPRET_RUNTIME_ERROR;
       }
       // Recall that this instruction comes from an expression statement, so no pop here
-      break;
+      g_vm.global_values.values[slot] = peek(0);
+      DISPATCH();
     }
 
-    case OP_GET_UPVALUE: {
+    CASE(OP_GET_UPVALUE) {
       uint8_t slot = READ_BYTE();
       // The location of the upvalue is in the heap!
       push(*frame->closure->upvalues[slot]->location);
-      break;
+      DISPATCH();
     }
-    case OP_SET_UPVALUE: {
+    CASE(OP_SET_UPVALUE) {
       uint8_t slot = READ_BYTE();
       // The location of the upvalue is in the heap!
-      *frame->closure->upvalues[slot]->location = peek(0);
-      break;
+      obj_upvalue_t *upvalue = frame->closure->upvalues[slot];
+      *upvalue->location = peek(0);
+      write_barrier(&upvalue->base, peek(0));
+      DISPATCH();
     }
 
-    case OP_GET_PROPERTY: {
+    CASE(OP_GET_PROPERTY) {
       // Only instances have properties.
       if(!IS_INSTANCE(peek(0))) {
+        SAVE_IP();
         runtime_error("Only instances have properties.");
         return INTERPRET_RUNTIME_ERROR;
       }
 
-      obj_instance_t *instance = AS_INSTANCE(peek(0));
       obj_string_t *name = READ_STRING();
-      value_t value;
+      inline_cache_t *cache = READ_CACHE();
+      SAVE_IP();
+      if(!get_property(name, cache, false)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    }
 
-      if(table_get(&instance->fields, name, &value)) {
-        pop(); // Instance
-        push(value);
-        break;
+    CASE(OP_GET_PROPERTY_PAIR) {
+      /*
+      Initializer of a local that the compiler knows is only ever called (see var_declaration()).
+      Instead of allocating a bound method, the local keeps the receiver in its own slot and the
+      method in the next one. A field leaves nil in the second slot. */
+      if(!IS_INSTANCE(peek(0))) {
+        SAVE_IP();
+        runtime_error("Only instances have properties.");
+        return INTERPRET_RUNTIME_ERROR;
       }
-      // Fields shadow methods
-      if(!bind_method(instance->klass, name)) {
+
+      obj_string_t *name = READ_STRING();
+      inline_cache_t *cache = READ_CACHE();
+      SAVE_IP();
+      if(!get_property(name, cache, true)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      break;
+      DISPATCH();
     }
 
-    case OP_SET_PROPERTY: {
+    CASE(OP_SET_PROPERTY) {
       // Only instances have fields. peek(1) because peek(0) is the value
       // we're setting.
       if(!IS_INSTANCE(peek(1))) {
+        SAVE_IP();
         runtime_error("Only instances have fields.");
         return INTERPRET_RUNTIME_ERROR;
       }
-      obj_instance_t *instance = AS_INSTANCE(peek(1));
-      table_set(&instance->fields, READ_STRING(), peek(0));
+      obj_string_t *name = READ_STRING();
+      set_property(name, READ_CACHE());
       value_t value = pop();
       pop();       // Instance
       push(value); // The result of a setter is the assigned value
-      break;
+      DISPATCH();
     }
 
-    case OP_EQUAL: {
+    CASE(OP_EQUAL) {
       value_t b = pop();
       value_t a = pop();
       push(BOOL_VAL(values_equal(a, b)));
-      break;
+      DISPATCH();
     }
 
-    case OP_GET_SUPER: {
+    CASE(OP_GET_SUPER) {
       obj_string_t *name = READ_STRING();
       obj_class_t *superclass = AS_CLASS(pop());
       // Now we have the instance on the stack.
 
+      SAVE_IP();
+
       if(!bind_method(superclass, name)) {
         return INTERPRET_RUNTIME_ERROR;
       }
       // Now we have the bound method on the stack.
-      break;
+      DISPATCH();
+    }
+    CASE(OP_GET_SUPER_PAIR) {
+      // Same as OP_GET_PROPERTY_PAIR: leave the instance and push the superclass method.
+      obj_string_t *name = READ_STRING();
+      obj_class_t *superclass = AS_CLASS(pop());
+      obj_closure_t *method;
+      SAVE_IP();
+      if(!find_method(superclass, name, &method)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      push(OBJ_VAL(method));
+      DISPATCH();
+    }
+    CASE(OP_GET_LOCAL_PAIR) {
+      /*
+      The pair is used as a value, so it escapes: bind it and keep the bound method in the local,
+      leaving nil in the method slot. Binding only once means that every read gives back the same
+      object, as it would without the pair. */
+      uint8_t slot = READ_BYTE();
+      if(!IS_NIL(frame->slots[slot + 1])) {
+        obj_bound_method_t *bound
+          = new_bound_method(frame->slots[slot], AS_CLOSURE(frame->slots[slot + 1]));
+        frame->slots[slot] = OBJ_VAL(bound);
+        frame->slots[slot + 1] = NIL_VAL;
+      }
+      push(frame->slots[slot]);
+      DISPATCH();
     }
 
-    case OP_GREATER: {
+    CASE(OP_GREATER) {
       BINARY_OP(BOOL_VAL, >);
-      break;
+      DISPATCH();
     }
 
-    case OP_LESS: {
+    CASE(OP_LESS) {
       BINARY_OP(BOOL_VAL, <);
-      break;
+      DISPATCH();
     }
 
-    case OP_ADD: {
+    CASE(OP_ADD) {
       if(IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
         double b = AS_NUMBER(pop());
         double a = AS_NUMBER(pop());
@@ -516,107 +1142,215 @@ static interpret_result_t run()
         concatenate();
       }
       else {
+        SAVE_IP();
+        runtime_error("Operands must be two numbers or two strings.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    }
+
+    CASE(OP_ADD_LOCALS) {
+      value_t a = frame->slots[READ_BYTE()];
+      value_t b = frame->slots[READ_BYTE()];
+      if(IS_NUMBER(a) && IS_NUMBER(b)) {
+        push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+      }
+      else if(IS_STRING(a) && IS_STRING(b)) {
+        push(a);
+        push(b);
+        concatenate();
+      }
+      else {
+        SAVE_IP();
         runtime_error("Operands must be two numbers or two strings.");
         return INTERPRET_RUNTIME_ERROR;
       }
-      break;
+      DISPATCH();
     }
 
-    case OP_SUBTRACT: {
+    CASE(OP_ADD_CONSTANT) {
+      // The constant is always a number
+      value_t constant = READ_CONSTANT();
+      if(!IS_NUMBER(peek(0))) {
+        SAVE_IP();
+        runtime_error("Operands must be two numbers or two strings.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      g_vm.stack_top[-1] = NUMBER_VAL(AS_NUMBER(peek(0)) + AS_NUMBER(constant));
+      DISPATCH();
+    }
+
+    CASE(OP_SUBTRACT) {
       BINARY_OP(NUMBER_VAL, -);
-      break;
+      DISPATCH();
     }
 
-    case OP_MULTIPLY: {
+    CASE(OP_MULTIPLY) {
       BINARY_OP(NUMBER_VAL, *);
-      break;
+      DISPATCH();
     }
 
-    case OP_DIVIDE: {
+    CASE(OP_DIVIDE) {
       BINARY_OP(NUMBER_VAL, /);
-      break;
+      DISPATCH();
     }
 
-    case OP_NOT: {
-      push(BOOL_VAL(isFalsey(pop())));
-      break;
+    CASE(OP_NOT) {
+      push(BOOL_VAL(is_falsey(pop())));
+      DISPATCH();
     }
 
-    case OP_NEGATE: {
+    CASE(OP_NEGATE) {
       if(!IS_NUMBER(peek(0))) {
+        SAVE_IP();
         runtime_error("Operand must be a number.");
         return INTERPRET_RUNTIME_ERROR;
       }
       push(NUMBER_VAL(-AS_NUMBER(pop())));
-      break;
+      DISPATCH();
     }
 
-    case OP_PRINT: {
+    CASE(OP_PRINT) {
       print_value(pop());
       printf("\n");
-      break;
+      DISPATCH();
     }
 
-    case OP_JUMP: {
+    CASE(OP_JUMP) {
       uint16_t offset = READ_SHORT();
-      frame->ip += offset;
-      break;
+      ip += offset;
+      DISPATCH();
     }
 
-    case OP_JUMP_IF_FALSE: {
+    CASE(OP_JUMP_IF_FALSE) {
       uint16_t offset = READ_SHORT();
       // Value is not popped, to see why look how logical operators are implemented.
-      if(isFalsey(peek(0))) {
-        frame->ip += offset;
+      if(is_falsey(peek(0))) {
+        ip += offset;
+      }
+      DISPATCH();
+    }
+
+    CASE(OP_LESS_JUMP) {
+      // The condition is never pushed, so the jump goes past the POP that would drop it
+      value_t a = frame->slots[READ_BYTE()];
+      value_t b = READ_CONSTANT();
+      uint16_t offset = READ_SHORT();
+      if(!IS_NUMBER(a) || !IS_NUMBER(b)) {
+        SAVE_IP();
+        runtime_error("Operands must be numbers.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      if(!(AS_NUMBER(a) < AS_NUMBER(b))) {
+        ip += offset;
       }
-      break;
+      DISPATCH();
     }
 
-    case OP_LOOP: {
+    CASE(OP_LOOP) {
       // Basically like OP_JUMP, but the offset is negative.
       // We could have used OP_JUMP, but the trouble is packing the Signed 16 bit integer offset.
       uint16_t offset = READ_SHORT();
-      frame->ip -= offset;
-      break;
+      ip -= offset;
+      SAFEPOINT();
+      DISPATCH();
     }
 
-    case OP_CALL: {
+    CASE(OP_CALL) {
       uint8_t arg_count = READ_BYTE();
+      SAFEPOINT();
+      SAVE_IP();
       if(!call_value(peek(arg_count), arg_count)) {
         // No function object on the stack! Exit
         return INTERPRET_RUNTIME_ERROR;
       }
       // There was a function object on the stack!
       // We need to update the current frame since run() uses it.
-      frame = &g_vm.frames[g_vm.frame_count - 1];
-      break;
+      LOAD_FRAME();
+      DISPATCH();
     }
 
-    case OP_INVOKE: {
+    CASE(OP_TAIL_CALL) {
+      // A call to a native, or to a class without initializer, pushes no frame and returns to the
+      // OP_RETURN that follows
+      uint8_t arg_count = READ_BYTE();
+      SAFEPOINT();
+      SAVE_IP();
+      int frame_count = g_vm.frame_count;
+      if(!call_value(peek(arg_count), arg_count)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      if(g_vm.frame_count > frame_count) {
+        reuse_frame();
+      }
+      LOAD_FRAME();
+      DISPATCH();
+    }
+
+    CASE(OP_CALL_PAIR) {
+      // The receiver of the pair is already in the callee slot, where the method expects `this`
+      uint8_t arg_count = READ_BYTE();
+      uint8_t slot = READ_BYTE();
+      SAFEPOINT();
+      SAVE_IP();
+      value_t method = frame->slots[slot];
+      if(IS_NIL(method)) {
+        // The local holds a plain value
+        if(!call_value(peek(arg_count), arg_count)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+      }
+      else if(!call(AS_CLOSURE(method), arg_count)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      LOAD_FRAME();
+      DISPATCH();
+    }
+
+    CASE(OP_INVOKE) {
       // Similar to OP_CALL
       obj_string_t *method_name = READ_STRING();
       uint8_t arg_count = READ_BYTE();
-      if(!invoke(method_name, arg_count)) {
+      inline_cache_t *cache = READ_CACHE();
+      SAVE_IP();
+      if(!invoke(method_name, arg_count, cache)) {
         return INTERPRET_RUNTIME_ERROR;
       }
       // We need to update the current frame since run() uses it.
-      frame = &g_vm.frames[g_vm.frame_count - 1];
-      break;
+      LOAD_FRAME();
+      DISPATCH();
+    }
+
+    CASE(OP_TAIL_INVOKE) {
+      obj_string_t *method_name = READ_STRING();
+      uint8_t arg_count = READ_BYTE();
+      inline_cache_t *cache = READ_CACHE();
+      SAVE_IP();
+      int frame_count = g_vm.frame_count;
+      if(!invoke(method_name, arg_count, cache)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      if(g_vm.frame_count > frame_count) {
+        reuse_frame();
+      }
+      LOAD_FRAME();
+      DISPATCH();
     }
 
-    case OP_SUPER_INVOKE: {
+    CASE(OP_SUPER_INVOKE) {
       obj_string_t *method_name = READ_STRING();
       uint8_t arg_count = READ_BYTE();
       obj_class_t *superclass = AS_CLASS(pop());
+      SAVE_IP();
       if(!invoke_from_class(superclass, method_name, arg_count)) {
         return INTERPRET_RUNTIME_ERROR;
       }
       // We need to update the current frame since run() uses it.
-      frame = &g_vm.frames[g_vm.frame_count - 1];
-      break;
+      LOAD_FRAME();
+      DISPATCH();
     }
 
-    case OP_CLOSURE: {
+    CASE(OP_CLOSURE) {
       obj_function_t *function = AS_FUNCTION(READ_CONSTANT());
       // Note that we wrap the compiled function into a closure object.
       obj_closure_t *closure = new_closure(function);
@@ -633,19 +1367,21 @@ static interpret_result_t run()
         else {
           closure->upvalues[i] = frame->closure->upvalues[index];
         }
+        // Capturing can trigger a GC that promotes the closure
+        write_barrier(&closure->base, OBJ_VAL(closure->upvalues[i]));
       }
 
-      break;
+      DISPATCH();
     }
 
-    case OP_CLOSE_UPVALUE: {
+    CASE(OP_CLOSE_UPVALUE) {
       // The variable that needs to be moved to the heap (closed) is on top of the stack.
       close_upvalues(g_vm.stack_top - 1);
       pop(); // Pop the variable that was moved to the heap
-      break;
+      DISPATCH();
     }
 
-    case OP_RETURN: {
+    CASE(OP_RETURN) {
       value_t result = pop(); // The value to be returned to the caller.
       // Before returning from a function, we need to close the open upvalues! The compiler does not
       // call end_scope() after parsing a function declaration.
@@ -659,20 +1395,21 @@ static interpret_result_t run()
         return INTERPRET_OK;
       }
       g_vm.stack_top = frame->slots;              // Pop all locals and parameters
-      frame = &g_vm.frames[g_vm.frame_count - 1]; // Reset frame pointer
+      LOAD_FRAME();                               // Reset frame pointer
       push(result);                               // Return value on the stack.
-      break;
+      DISPATCH();
     }
 
-    case OP_CLASS: {
+    CASE(OP_CLASS) {
       push(OBJ_VAL(new_class(READ_STRING())));
-      break;
+      DISPATCH();
     }
 
-    case OP_INHERIT: {
+    CASE(OP_INHERIT) {
       value_t superclass = peek(1);
 
       if(!IS_CLASS(superclass)) {
+        SAVE_IP();
         runtime_error("Superclass must be a class.");
         return INTERPRET_RUNTIME_ERROR;
       }
@@ -682,23 +1419,151 @@ static interpret_result_t run()
       Also note that this instruction is emitted before any OP_METHOD instructions, meaning that
       it won't overwrite subclass methods. That at most happens while parsing the methods. */
       table_add_all(&AS_CLASS(superclass)->methods, &subclass->methods);
+      write_barrier_object(&subclass->base);
       pop(); // Subclass
       // Superclass is popped after parsing the methods..
-      break;
+      DISPATCH();
     }
 
-    case OP_METHOD: {
+    CASE(OP_METHOD) {
       define_method(READ_STRING());
-      break;
+      DISPATCH();
     }
+
+    CASE(OP_REG_MOVE) {
+      g_vm.stack_top = frame->slots + READ_BYTE();
+      uint8_t dst = READ_BYTE();
+      frame->slots[dst] = READ_REGISTER();
+      DISPATCH();
+    }
+
+    CASE(OP_REG_LOADK) {
+      g_vm.stack_top = frame->slots + READ_BYTE();
+      uint8_t dst = READ_BYTE();
+      frame->slots[dst] = READ_CONSTANT();
+      DISPATCH();
+    }
+
+    CASE(OP_REG_ADD) {
+      REGISTER_ADD(READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_ADDK) {
+      REGISTER_ADD(READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_SUBTRACT) {
+      REGISTER_OP(NUMBER_VAL, -, READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_SUBTRACTK) {
+      REGISTER_OP(NUMBER_VAL, -, READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_MULTIPLY) {
+      REGISTER_OP(NUMBER_VAL, *, READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_MULTIPLYK) {
+      REGISTER_OP(NUMBER_VAL, *, READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_DIVIDE) {
+      REGISTER_OP(NUMBER_VAL, /, READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_DIVIDEK) {
+      REGISTER_OP(NUMBER_VAL, /, READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_EQUAL) {
+      REGISTER_EQUAL(READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_EQUALK) {
+      REGISTER_EQUAL(READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_GREATER) {
+      REGISTER_OP(BOOL_VAL, >, READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_GREATERK) {
+      REGISTER_OP(BOOL_VAL, >, READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_LESS) {
+      REGISTER_OP(BOOL_VAL, <, READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_LESSK) {
+      REGISTER_OP(BOOL_VAL, <, READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_EQUAL_JUMP) {
+      REGISTER_EQUAL_JUMP(READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_EQUAL_JUMPK) {
+      REGISTER_EQUAL_JUMP(READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_GREATER_JUMP) {
+      REGISTER_JUMP(>, READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_GREATER_JUMPK) {
+      REGISTER_JUMP(>, READ_CONSTANT());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_LESS_JUMP) {
+      REGISTER_JUMP(<, READ_REGISTER());
+      DISPATCH();
+    }
+
+    CASE(OP_REG_LESS_JUMPK) {
+      REGISTER_JUMP(<, READ_CONSTANT());
+      DISPATCH();
     }
   }
 
+#undef SAVE_IP
+#undef LOAD_FRAME
+#undef SAFEPOINT
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_STRING
+#undef READ_CACHE
 #undef BINARY_OP
+#undef READ_REGISTER
+#undef REGISTER_OP
+#undef REGISTER_ADD
+#undef REGISTER_EQUAL
+#undef REGISTER_JUMP
+#undef REGISTER_EQUAL_JUMP
+#undef NEXT_INSTRUCTION
+#undef INTERPRET_LOOP
+#undef CASE
+#undef DISPATCH
 }
 
 interpret_result_t interpret(const char *source)